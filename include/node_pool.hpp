@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace RBTree {
+
+/*
+    Bump allocator for tree nodes: nodes are placed in blocks of growing size and
+    are never freed one by one, all storage is released at once.
+    Pool only manages memory, owner is responsible for calling node destructors.
+*/
+template <typename NodeT>
+class NodePool {
+    static constexpr std::size_t min_block_size = 64;
+    static constexpr std::size_t max_block_size = 1 << 16;
+
+    std::vector<std::pair<NodeT *, std::size_t>> blocks_;
+
+    NodeT *cur_ = nullptr;
+    NodeT *end_ = nullptr;
+
+    std::size_t next_block_size_ = min_block_size;
+
+    static NodeT *allocate_storage(std::size_t count) {
+        return static_cast<NodeT *>(::operator new(count * sizeof(NodeT), std::align_val_t{alignof(NodeT)}));
+    }
+
+    static void free_storage(NodeT *nodes, std::size_t count) {
+        ::operator delete(nodes, count * sizeof(NodeT), std::align_val_t{alignof(NodeT)});
+    }
+
+public:
+    NodePool() : blocks_() {}
+    ~NodePool() { release(); }
+
+    NodePool(const NodePool& rhs) = delete;
+    NodePool &operator=(const NodePool& rhs) = delete;
+
+    NodePool(NodePool&& rhs) noexcept
+        : blocks_(std::move(rhs.blocks_)),
+          cur_(std::exchange(rhs.cur_, nullptr)),
+          end_(std::exchange(rhs.end_, nullptr)),
+          next_block_size_(std::exchange(rhs.next_block_size_, min_block_size)) {}
+
+    NodePool &operator=(NodePool&& rhs) noexcept {
+        std::swap(blocks_, rhs.blocks_);
+        std::swap(cur_, rhs.cur_);
+        std::swap(end_, rhs.end_);
+        std::swap(next_block_size_, rhs.next_block_size_);
+        return *this;
+    }
+
+    template <typename... Args>
+    NodeT *create(Args&&... args) {
+        if (cur_ == end_) {
+            cur_ = allocate_block(next_block_size_);
+            end_ = cur_ + next_block_size_;
+            if (next_block_size_ < max_block_size)
+                next_block_size_ *= 2;
+        }
+
+        return new (cur_++) NodeT(std::forward<Args>(args)...);
+    }
+
+    /// Returns uninitialized storage for count adjacent nodes
+    NodeT *allocate_block(std::size_t count) {
+        NodeT *nodes = allocate_storage(count);
+        blocks_.emplace_back(nodes, count);
+        return nodes;
+    }
+
+    /// Frees all blocks, nodes in them must be already destroyed
+    void release() {
+        for (auto [nodes, count]: blocks_) {
+            free_storage(nodes, count);
+        }
+        blocks_.clear();
+
+        cur_ = end_ = nullptr;
+        next_block_size_ = min_block_size;
+    }
+};
+
+/*
+    Node storage of Tree: type of links between nodes and pool that allocates nodes.
+    Default one keeps nodes in memory and links them with plain pointers,
+    persistent storages (rbtree_mapped.hpp) also implement compact() themselves.
+*/
+struct pool_storage {
+    template <typename NodeT>
+    using link = NodeT *;
+
+    template <typename NodeT>
+    using pool = NodePool<NodeT>;
+
+    // nodes are destroyed with the tree
+    static constexpr bool persistent = false;
+};
+
+} // namespace RBTree
@@ -1,13 +1,24 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <functional>
 #include <ostream>
+#include <span>
 #include <stack>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 #include <cassert>
+#include <cstdint>
 
 #include "gtest/gtest.h"
 #include "gtest/gtest_prod.h"
 
+#include "node_pool.hpp"
+#include "rbtree_balance.hpp"
+
 namespace RBTree {
 
 enum class Order {
@@ -26,44 +37,115 @@ Order compare(const T &lhs, const T &rhs) {
     return Order::equal;
 }
 
-template <typename T, typename CompT = std::less<T>>
+/// Default key prefix traits: nodes store no prefix
+struct no_key_prefix {};
+
+/*
+    Key prefix traits: encode(key) maps key to 8-byte integer preserving the order of CompT:
+    encode(a) < encode(b) must imply a < b, equal prefixes are resolved by full comparison.
+    Prefix is stored inline in nodes, so most comparisons don't touch key's heap buffer.
+*/
+struct string_key_prefix {
+    /// First 8 bytes in big-endian order, shorter keys are padded with zeros
+    static std::uint64_t encode(const std::string &key) {
+        std::uint64_t prefix = 0;
+        std::size_t length = std::min(key.size(), sizeof(prefix));
+        for (std::size_t index = 0; index < sizeof(prefix); index++) {
+            prefix <<= 8;
+            if (index < length)
+                prefix |= static_cast<unsigned char>(key[index]);
+        }
+        return prefix;
+    }
+};
+
+/// BalanceT is a balancing policy from rbtree_balance.hpp, StorageT is a node storage (see pool_storage)
+template <typename T, typename CompT = std::less<T>, typename PrefixT = no_key_prefix,
+          typename BalanceT = red_black, typename StorageT = pool_storage>
 class Tree {
-    enum class Color {
-        black,
-        red,
-    };
+    friend BalanceT;
+    friend StorageT;
+
+    static constexpr bool has_prefix = !std::is_same_v<PrefixT, no_key_prefix>;
+
+    struct no_prefix {};
+    using prefix_type = std::conditional_t<has_prefix, std::uint64_t, no_prefix>;
+
+    static prefix_type make_prefix([[maybe_unused]] const T& key) {
+        if constexpr (has_prefix)
+            return PrefixT::encode(key);
+        else
+            return {};
+    }
 
     struct Node {
-        T key_;
+        using Link = typename StorageT::template link<Node>;
+        using Balance = BalanceT;
 
-        Node *parent_ = nullptr;
-        Node *left_   = nullptr;
-        Node *right_  = nullptr;
+        // key is not constructed in the nil sentinel, so T needs no default constructor
+        union {
+            T key_;
+            unsigned char no_key_;
+        };
 
-        Color color_ = Color::black;
+        Link parent_ = nullptr;
+        Link left_   = nullptr;
+        Link right_  = nullptr;
 
         std::size_t tree_size_ = 1;
 
-        Node(const T& key, Color color = Color::black) : key_(key), color_(color) {}
-        Node(const T& key, Node * parent, Color color = Color::black) : key_(key), parent_(parent), color_(color) {}
-        Node(const T& key, Node * parent, Node * left, Node * right, Color color = Color::black) : key_(key), parent_(parent), left_(left), right_(right), color_(color) {}
+        // inline key prefix, compared before the key itself
+        [[no_unique_address]] prefix_type prefix_{};
+
+        // data of the balancing policy (color, height, priority), set by its hooks
+        [[no_unique_address]] typename BalanceT::node_data balance_{};
+
+        struct nil_tag {};
+
+        Node(const T& key) : key_(key), prefix_(make_prefix(key_)) {}
+        Node(const T& key, Node * parent) : key_(key), parent_(parent), prefix_(make_prefix(key_)) {}
+        Node(const T& key, Node * parent, Node * left, Node * right) : key_(key), parent_(parent), left_(left), right_(right), prefix_(make_prefix(key_)) {}
+
+        template <typename... Args>
+        Node(std::in_place_t, Node * parent, Args&&... args) : key_(std::forward<Args>(args)...), parent_(parent), prefix_(make_prefix(key_)) {}
+
+        constexpr explicit Node(nil_tag) : no_key_(0), parent_(this), left_(this), right_(this), tree_size_(0) {}
+
+        ~Node() {
+            if (!is_nil())
+                key_.~T();
+        }
 
         Node(const Node& rhs) = delete;
         Node &operator=(const Node& rhs) = delete;
 
         bool is_nil() const { return this == parent_; }
 
-        void make_nil() {
-            parent_ = this;
-            right_  = this;
-            left_   = this;
-            color_ = Color::black;
-            tree_size_ = 0;
-        }
+        /// For links that don't store the sentinel address
+        static constexpr Node *nil() { return &nil_node_; }
     };
 
-    Node *root_ = nullptr;
-    Node *tree_nil_ = nullptr;
+    /*
+        Sentinel is shared by all trees of the same type: it is never modified after
+        construction, so empty and moved-from trees need no allocations.
+    */
+    constinit static inline Node nil_node_{typename Node::nil_tag{}};
+
+    Node *root_ = &nil_node_;
+    Node *tree_nil_ = &nil_node_;
+
+    typename StorageT::template pool<Node> pool_;
+
+    template <typename... Args>
+    Node *create_node(Args&&... args) { return pool_.create(std::forward<Args>(args)...); }
+
+    /// Subtrees larger than this are cloned in separate threads
+    static constexpr std::size_t parallel_clone_threshold = 1 << 14;
+
+    Node *clone_subtree(const Node *src, Node *dst, Node *parent) const;
+
+    /// Large subtrees are copied concurrently, defined in rbtree_parallel.hpp
+    Node *clone_subtree(const Node *src, Node *dst, Node *parent, unsigned threads) const;
 
     /*
           x               y
@@ -79,15 +161,74 @@ class Tree {
     */
     void right_rotate(Node *node);
 
-    void insert_fixup(Node *node);
+    /// Compares key with node key, prefixes are compared first if nodes store them
+    static Order compare_key(const T& key, [[maybe_unused]] prefix_type key_prefix, const Node *node) {
+        if constexpr (has_prefix) {
+            if (key_prefix != node->prefix_)
+                return (key_prefix < node->prefix_) ? Order::less : Order::greater;
+        }
+        return compare<T, CompT>(key, node->key_);
+    }
+
+    /// Returns parent for new key and side to attach it or nullptr if key is already in the tree, from is root of searched subtree
+    Node *find_parent(const T& key, Order &side, Node *from) const;
+
+    /// Links new node below parent found by find_parent and rebalances, returns the new node
+    template <typename K>
+    Node *attach(Node *parent, Order side, K&& key);
+
+    /// Bound searches, last node of the search path goes to last_visited
+    Node *lower_bound_node(const T& key, Node *&last_visited) const;
+    Node *upper_bound_node(const T& key, Node *&last_visited) const;
+
+    /// Number of queries that are descended in lockstep
+    static constexpr std::size_t batch_group_size = 16;
+
+    /// Number of keys less than key (or not greater if inclusive)
+    std::size_t rank(const T& key, bool inclusive) const;
+
+    template <typename StepFn>
+    void descend_batch(std::size_t count, StepFn step) const;
 
-    void print_dot_debug_recursive(std::ostream &stream, const Node *node) const;
+    template <typename K>
+    bool insert_unique(K&& key);
 
-    bool validate_subtree(const Node *node) const;
+    void print_dot_debug_nodes(std::ostream &stream, const Node *root) const;
+
+    /// Height is the one BalanceT::check computes
+    bool validate_subtree(const Node *node, std::size_t &height) const;
+
+    void clear();
+
+    /// Appends nodes of subtree truncated at levels to order in van Emde Boas layout, deeper subtrees go to frontier
+    void van_emde_boas_order(Node *node, std::size_t levels, std::vector<Node *> &order,
+                             std::vector<Node *> &frontier) const;
+
+    Node *build_balanced(const T *keys, std::size_t count, Node *parent,
+                         unsigned depth, unsigned red_depth);
+    Node *build_from_shape(const T *keys, const unsigned char *shape, std::size_t count);
+
+public:
+    enum class Layout {
+        // pre-order: every subtree is contiguous, left child is next to its parent
+        depth_first,
+        // recursive blocks of half the height: any descent touches O(log n / log B) blocks of B nodes
+        van_emde_boas,
+    };
+
+private:
+    // successful inserts before automatic compaction, 0 disables it
+    std::size_t auto_compact_inserts_ = 0;
+    std::size_t inserts_since_compact_ = 0;
+    Layout auto_compact_layout_ = Layout::van_emde_boas;
+
+    /// compact() for storages that keep nodes in memory
+    void compact_to_block(Layout layout);
 
 public:
     struct iterator {
         const Node *ptr_;
+        iterator(): ptr_(&nil_node_) {}
         iterator(const Node *node): ptr_(node) {}
 
         const T& operator*() const { return ptr_->key_; }
@@ -120,64 +261,151 @@ public:
         bool operator==(const iterator& rhs) {return ptr_ == rhs.ptr_; }
     };
 
-    Tree() {
-        tree_nil_ = new Node(T());
-        tree_nil_->make_nil();
-        root_ = tree_nil_;
-    }
+    Tree() : pool_() {}
     ~Tree() {
-        std::stack<Node *> stack;
-        Node * node = root_;
-
-        while (true) {
-            while (node != tree_nil_) {
-                stack.push(node);
-                node = node->left_;
-            }
+        // persistent storage keeps nodes after the tree is gone
+        if constexpr (!StorageT::persistent)
+            clear();
+    }
 
-            if (stack.empty())
-                break;
+    Tree(const Tree& rhs) : pool_(), auto_compact_inserts_(rhs.auto_compact_inserts_),
+                            auto_compact_layout_(rhs.auto_compact_layout_) {
+        if (rhs.root_ != rhs.tree_nil_)
+            root_ = rhs.clone_subtree(rhs.root_, pool_.allocate_block(rhs.size()), tree_nil_);
+    }
 
-            Node * prev_node = stack.top();
-            stack.pop();
+    Tree &operator=(const Tree& rhs) {
+        if (&rhs == this)
+            return *this;
 
-            node = prev_node->right_;
-            delete prev_node;
-        }
+        Tree copy(rhs);
+        std::swap(copy.root_, root_);
+        std::swap(copy.pool_, pool_);
+        auto_compact_inserts_ = rhs.auto_compact_inserts_;
+        auto_compact_layout_  = rhs.auto_compact_layout_;
+        inserts_since_compact_ = 0;
 
-        delete tree_nil_;
+        return *this;
     }
 
-    Tree(const Tree& rhs) = delete;
-    Tree &operator=(const Tree& rhs) = delete;
+    /// O(n) copy preserving shape
+    Tree clone() const {
+        Tree copy;
+        if (root_ != tree_nil_)
+            copy.root_ = clone_subtree(root_, copy.pool_.allocate_block(size()), tree_nil_);
 
-    Tree(Tree&& rhs): tree_nil_(rhs.tree_nil_), root_(rhs.root_) {
-        rhs.tree_nil_ = new Node(T());
-        rhs.tree_nil_->make_nil();
-        rhs.root_ = rhs.tree_nil_;
+        return copy;
     }
+
+    /// With threads > 1 large subtrees are copied concurrently, defined in rbtree_parallel.hpp
+    Tree clone(unsigned threads) const;
+
+    Tree(Tree&& rhs) noexcept : root_(std::exchange(rhs.root_, rhs.tree_nil_)), pool_(std::move(rhs.pool_)),
+                                auto_compact_inserts_(rhs.auto_compact_inserts_),
+                                inserts_since_compact_(std::exchange(rhs.inserts_since_compact_, 0)),
+                                auto_compact_layout_(rhs.auto_compact_layout_) {}
     FRIEND_TEST(Move, Ctor);
 
-    Tree &operator=(Tree&& rhs) {
+    Tree &operator=(Tree&& rhs) noexcept {
         if (&rhs == this)
             return *this;
 
         std::swap(rhs.root_, root_);
-        std::swap(rhs.tree_nil_, tree_nil_);
+        std::swap(rhs.pool_, pool_);
+        std::swap(rhs.auto_compact_inserts_, auto_compact_inserts_);
+        std::swap(rhs.inserts_since_compact_, inserts_since_compact_);
+        std::swap(rhs.auto_compact_layout_, auto_compact_layout_);
 
         return *this;
     }
     FRIEND_TEST(Move, Assign);
 
 
-    void insert(const T& key);
+    /// Inserts key if it is not in the tree yet, returns true if key was inserted
+    bool insert(const T& key) { return insert_unique(key); }
+    bool insert(T&& key)      { return insert_unique(std::move(key)); }
+
+    /// Constructs key from args, node is allocated only if the key is not in the tree yet
+    template <typename... Args>
+    bool emplace(Args&&... args);
+
+    /*
+        Inserts keys sorted by CompT in one left to right pass: search for the next key starts
+        from the previous inserted node, so close keys take O(log distance) instead of a full descent.
+    */
+    void insert_sorted(std::span<const T> keys);
+
+    /// Replaces contents with sorted unique keys in O(n) without comparisons
+    void assign_sorted(std::span<const T> keys);
+
+    /*
+        Moves all nodes to one contiguous block in given layout, tree shape is kept but iterators are invalidated.
+        Nodes allocated by later inserts go to new blocks as usual.
+    */
+    void compact(Layout layout = Layout::van_emde_boas);
+    FRIEND_TEST(Compact, Layouts);
+
+    /// Calls compact(layout) after every inserts successful inserts, 0 disables it
+    void set_auto_compact(std::size_t inserts, Layout layout = Layout::van_emde_boas) {
+        auto_compact_inserts_  = inserts;
+        auto_compact_layout_   = layout;
+        inserts_since_compact_ = 0;
+    }
 
     iterator get_root() const {
         return iterator(root_);
     }
 
-    iterator lower_bound(const T& key) const;
-    iterator upper_bound(const T& key) const;
+    /// Smallest key, end() for empty tree
+    iterator begin() const {
+        const Node *node = root_;
+        while (node->left_ != tree_nil_)
+            node = node->left_;
+        return iterator(node);
+    }
+
+    iterator end() const { return iterator(tree_nil_); }
+
+    std::size_t size() const { return root_->tree_size_; }
+
+    /// Number of nodes on the longest path from root
+    std::size_t height() const;
+
+    /*
+        Const lookups never modify the tree. Non-const ones also pass the last visited node
+        to BalanceT::after_access, so splay trees restructure only through them.
+    */
+    iterator lower_bound(const T& key) const {
+        Node *last_visited = tree_nil_;
+        return lower_bound_node(key, last_visited);
+    }
+    iterator upper_bound(const T& key) const {
+        Node *last_visited = tree_nil_;
+        return upper_bound_node(key, last_visited);
+    }
+
+    iterator lower_bound(const T& key) {
+        Node *last_visited = tree_nil_;
+        iterator it = lower_bound_node(key, last_visited);
+        BalanceT::after_access(*this, last_visited);
+        return it;
+    }
+    iterator upper_bound(const T& key) {
+        Node *last_visited = tree_nil_;
+        iterator it = upper_bound_node(key, last_visited);
+        BalanceT::after_access(*this, last_visited);
+        return it;
+    }
+
+    /// Number of keys in [lo, hi]
+    std::size_t count_range(const T& lo, const T& hi) const;
+
+    /*
+        Batched versions: queries are walked through the tree in lockstep groups and next node
+        of every query is prefetched while others are compared, so cache misses overlap.
+    */
+    void lower_bound_batch(std::span<const T> keys, std::span<iterator> result) const;
+    void count_range_batch(std::span<const T> lo, std::span<const T> hi, std::span<std::size_t> result) const;
 
     std::size_t distance(const iterator fst, const iterator snd) const {
         /*
@@ -223,18 +451,24 @@ public:
 
     bool validate() const;
 
+    /* SNAPSHOT FUNCTIONS HERE */
+    bool save(const std::string &path) const;
+    bool load(const std::string &path);
+
     FRIEND_TEST(RotateTest, LeftRotate);
     FRIEND_TEST(RotateTest, RightRotate);
 };
 
-template <typename T, typename CompT>
-void Tree<T, CompT>::insert(const T& key) {
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+Tree<T, CompT, PrefixT, BalanceT, StorageT>::Node *Tree<T, CompT, PrefixT, BalanceT, StorageT>::find_parent(const T& key, Order &side, Node *from) const {
     Node *prev = tree_nil_;
-    Node *cur = root_;
+    Node *cur = from;
+    const prefix_type key_prefix = make_prefix(key);
 
     while (cur != tree_nil_) {
         prev = cur;
-        switch(compare<T, CompT>(key, cur->key_)) {
+        side = compare_key(key, key_prefix, cur);
+        switch(side) {
         case Order::less:
             cur = cur->left_;
             break;
@@ -243,79 +477,110 @@ void Tree<T, CompT>::insert(const T& key) {
             break;
         case Order::equal: default:
             // equals so do not insert
-            return;
+            return nullptr;
         }
     }
 
-    // TODO: reduce number of comps
-    Node *new_node = new Node(key, prev, Color::red);
+    return prev;
+}
+
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+template <typename K>
+Tree<T, CompT, PrefixT, BalanceT, StorageT>::Node *Tree<T, CompT, PrefixT, BalanceT, StorageT>::attach(Node *prev, Order side, K&& key) {
+    // key is constructed only after we know it is unique
+    Node *new_node = create_node(std::in_place, prev, std::forward<K>(key));
     new_node->left_ = new_node->right_ = tree_nil_;
 
     // empty tree
     if (prev == tree_nil_) {
         root_ = new_node;
     // othwerise put new node to the correct subtree
-    } else if (compare<T, CompT>(new_node->key_, prev->key_) == Order::less) {
+    } else if (side == Order::less) {
         prev->left_ = new_node;
     } else {
         prev->right_ = new_node;
     }
 
     // go up to update sizes
-    cur = prev;
+    Node *cur = prev;
     while (cur != tree_nil_) {
         cur->tree_size_ += 1;
         cur = cur->parent_;
     }
 
-    insert_fixup(new_node);
+    BalanceT::after_insert(*this, new_node);
+    return new_node;
 }
 
-template <typename T, typename CompT>
-void Tree<T, CompT>::insert_fixup(Node *node) {
-    while (node->parent_->color_ == Color::red)
-    {
-        if (node->parent_ == node->parent_->parent_->left_) {
-            Node *y = node->parent_->parent_->right_;
-            if (y->color_ == Color::red) {
-                node->parent_->color_ = Color::black;
-                y->color_ = Color::black;
-                node->parent_->parent_->color_ = Color::red;
-                node = node->parent_->parent_;
-            } else {
-                if (node == node->parent_->right_) {
-                    node = node->parent_;
-                    left_rotate(node);
-                }
-                node->parent_->color_ = Color::black;
-                node->parent_->parent_->color_ = Color::red;
-                right_rotate(node->parent_->parent_);
-            }
-        }
-        else {
-            Node *y = node->parent_->parent_->left_;
-            if (y->color_ == Color::red) {
-                node->parent_->color_ = Color::black;
-                y->color_ = Color::black;
-                node->parent_->parent_->color_ = Color::red;
-                node = node->parent_->parent_;
-            } else {
-                if (node == node->parent_->left_) {
-                    node = node->parent_;
-                    right_rotate(node);
-                }
-                node->parent_->color_ = Color::black;
-                node->parent_->parent_->color_ = Color::red;
-                left_rotate(node->parent_->parent_);
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+template <typename K>
+bool Tree<T, CompT, PrefixT, BalanceT, StorageT>::insert_unique(K&& key) {
+    Order side = Order::equal;
+    Node *prev = find_parent(key, side, root_);
+    if (!prev)
+        return false;
+
+    attach(prev, side, std::forward<K>(key));
+
+    if (auto_compact_inserts_ && ++inserts_since_compact_ >= auto_compact_inserts_)
+        compact(auto_compact_layout_);
+
+    return true;
+}
+
+/*
+    Finger search: from the previous node go up while the next key is not below the
+    upper bound of the subtree. Right child shares the upper bound with its parent,
+    left child is bounded by its parent key. Rotations keep parent links valid.
+    Keys of a batch of m keys are ~n/m apart: going up and down takes 2 log(n/m) steps,
+    which is shorter than a descent from the root only if m > sqrt(n).
+*/
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+void Tree<T, CompT, PrefixT, BalanceT, StorageT>::insert_sorted(std::span<const T> keys) {
+    const bool use_finger = keys.size() * keys.size() > size();
+    Node *finger = tree_nil_;
+    std::size_t inserted = 0;
+
+    for (const T& key: keys) {
+        Node *from = root_;
+        if (use_finger && finger != tree_nil_) {
+            from = finger;
+            while (from->parent_ != tree_nil_ &&
+                   (from == from->parent_->right_ || !CompT{}(key, from->parent_->key_))) {
+                from = from->parent_;
             }
         }
+
+        Order side = Order::equal;
+        Node *prev = find_parent(key, side, from);
+        if (!prev)
+            continue;
+
+        finger = attach(prev, side, key);
+        inserted++;
     }
 
-    root_->color_ = Color::black;
+    // compaction moves nodes, so it is not done in the middle of the pass
+    if (auto_compact_inserts_) {
+        inserts_since_compact_ += inserted;
+        if (inserts_since_compact_ >= auto_compact_inserts_)
+            compact(auto_compact_layout_);
+    }
 }
 
-template <typename T, typename CompT>
-void Tree<T, CompT>::left_rotate(Node *node) {
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+template <typename... Args>
+bool Tree<T, CompT, PrefixT, BalanceT, StorageT>::emplace(Args&&... args) {
+    if constexpr (sizeof...(Args) == 1 && (std::is_same_v<std::remove_cvref_t<Args>, T> && ...)) {
+        return insert_unique(std::forward<Args>(args)...);
+    } else {
+        // key is needed for comparisons, so build it on stack and move into node
+        return insert_unique(T(std::forward<Args>(args)...));
+    }
+}
+
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+void Tree<T, CompT, PrefixT, BalanceT, StorageT>::left_rotate(Node *node) {
     /*
           x                y
         a   y    -->     x   c
@@ -356,8 +621,8 @@ void Tree<T, CompT>::left_rotate(Node *node) {
     y->tree_size_ = 1 + y->left_->tree_size_ + y->right_->tree_size_;
 }
 
-template <typename T, typename CompT>
-void Tree<T, CompT>::right_rotate(Node *node) {
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+void Tree<T, CompT, PrefixT, BalanceT, StorageT>::right_rotate(Node *node) {
     /*
         x           y
       y   c  -->  a   x
@@ -399,14 +664,16 @@ void Tree<T, CompT>::right_rotate(Node *node) {
     y->tree_size_ = 1 + y->left_->tree_size_ + y->right_->tree_size_;
 }
 
-/// Returns an iterator pointing to the first element that is not less than key.
-template<typename T, typename CompT>
-Tree<T, CompT>::iterator Tree<T, CompT>::lower_bound(const T& key) const {
+/// Returns the first node that is not less than key.
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+Tree<T, CompT, PrefixT, BalanceT, StorageT>::Node *Tree<T, CompT, PrefixT, BalanceT, StorageT>::lower_bound_node(const T& key, Node *&last_visited) const {
     Node *node = root_;
     Node *last_closest = tree_nil_;
+    const prefix_type key_prefix = make_prefix(key);
 
     while (node != tree_nil_) {
-        switch(compare<T, CompT>(key, node->key_)) {
+        last_visited = node;
+        switch(compare_key(key, key_prefix, node)) {
         case Order::less:
             last_closest = node;
             node = node->left_;
@@ -418,17 +685,19 @@ Tree<T, CompT>::iterator Tree<T, CompT>::lower_bound(const T& key) const {
             return node;
         }
     }
-    return iterator(last_closest);
+    return last_closest;
 }
 
-/// Returns an iterator pointing to the first element that is greater than key.
-template<typename T, typename CompT>
-Tree<T, CompT>::iterator Tree<T, CompT>::upper_bound(const T& key) const {
+/// Returns the first node that is greater than key.
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+Tree<T, CompT, PrefixT, BalanceT, StorageT>::Node *Tree<T, CompT, PrefixT, BalanceT, StorageT>::upper_bound_node(const T& key, Node *&last_visited) const {
     Node *node = root_;
     Node *last_closest = tree_nil_;
+    const prefix_type key_prefix = make_prefix(key);
 
     while (node != tree_nil_) {
-        switch(compare<T, CompT>(key, node->key_)) {
+        last_visited = node;
+        switch(compare_key(key, key_prefix, node)) {
         case Order::less:
             last_closest = node;
             node = node->left_;
@@ -439,30 +708,450 @@ Tree<T, CompT>::iterator Tree<T, CompT>::upper_bound(const T& key) const {
             break;
         }
     }
-    return iterator(last_closest);
+    return last_closest;
 }
 
-template <typename T, typename CompT>
-bool Tree<T, CompT>::validate_subtree(const Node *node) const {
-    if (node->is_nil()) return node->tree_size_ == 0;
+/*
+    Rank is accumulated only from nodes on the search path:
+    going right from node adds node size minus size of its right child, which is
+    the next node on the path anyway, so no extra cache lines are touched.
+*/
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+std::size_t Tree<T, CompT, PrefixT, BalanceT, StorageT>::rank(const T& key, bool inclusive) const {
+    const Node *node = root_;
+    std::size_t rank = 0;
+    const prefix_type key_prefix = make_prefix(key);
 
-    if (!validate_subtree(node->left_)) {
-        return false;
+    while (node != tree_nil_) {
+        Order order = compare_key(key, key_prefix, node);
+        bool go_right = inclusive ? (order != Order::less) : (order == Order::greater);
+        if (go_right) {
+            rank += node->tree_size_;
+            node = node->right_;
+            rank -= node->tree_size_;
+        } else {
+            node = node->left_;
+        }
     }
-    if (!validate_subtree(node->right_)) {
-        return false;
+
+    return rank;
+}
+
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+std::size_t Tree<T, CompT, PrefixT, BalanceT, StorageT>::count_range(const T& lo, const T& hi) const {
+    if (CompT{}(hi, lo))
+        return 0;
+
+    return rank(hi, true) - rank(lo, false);
+}
+
+/*
+    Descends count queries in groups of batch_group_size.
+    step(index, node) processes one level of query index and returns its next node (nil when done).
+    Next node is prefetched and the rest of the group is processed before it is touched.
+*/
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+template <typename StepFn>
+void Tree<T, CompT, PrefixT, BalanceT, StorageT>::descend_batch(std::size_t count, StepFn step) const {
+    std::array<const Node *, batch_group_size> nodes{};
+
+    for (std::size_t base = 0; base < count; base += batch_group_size) {
+        const std::size_t group = std::min(batch_group_size, count - base);
+        std::fill_n(nodes.begin(), group, root_);
+
+        bool active = (root_ != tree_nil_);
+        while (active) {
+            active = false;
+            for (std::size_t index = 0; index < group; index++) {
+                if (nodes[index] == tree_nil_)
+                    continue;
+
+                nodes[index] = step(base + index, nodes[index]);
+                __builtin_prefetch(nodes[index]);
+                active |= (nodes[index] != tree_nil_);
+            }
+        }
     }
+}
 
-    if (node->left_->tree_size_ + node->right_->tree_size_ + 1 != node->tree_size_) {
-        return false;
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+void Tree<T, CompT, PrefixT, BalanceT, StorageT>::lower_bound_batch(std::span<const T> keys, std::span<iterator> result) const {
+    assert(keys.size() == result.size());
+    std::fill(result.begin(), result.end(), iterator(tree_nil_));
+
+    std::array<prefix_type, batch_group_size> prefixes{};
+    descend_batch(keys.size(), [&](std::size_t index, const Node *node) -> const Node * {
+        prefix_type &key_prefix = prefixes[index % batch_group_size];
+        if (node == root_)
+            key_prefix = make_prefix(keys[index]);
+
+        switch(compare_key(keys[index], key_prefix, node)) {
+        case Order::less:
+            result[index] = iterator(node);
+            return node->left_;
+        case Order::greater:
+            return node->right_;
+        case Order::equal: default:
+            result[index] = iterator(node);
+            return tree_nil_;
+        }
+    });
+}
+
+/*
+    Every query is two independent rank descents: even ones for lo, odd ones for hi.
+    Result accumulates rank(hi, inclusive) - rank(lo), unsigned wrap-around cancels out.
+    Size of the right child is subtracted on the next step, when the child is already prefetched.
+*/
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+void Tree<T, CompT, PrefixT, BalanceT, StorageT>::count_range_batch(std::span<const T> lo, std::span<const T> hi,
+                                       std::span<std::size_t> result) const {
+    assert(lo.size() == hi.size() && lo.size() == result.size());
+    std::fill(result.begin(), result.end(), 0);
+
+    std::array<prefix_type, batch_group_size> prefixes{};
+    descend_batch(2 * result.size(), [&](std::size_t index, const Node *node) -> const Node * {
+        std::size_t &count = result[index / 2];
+        bool is_hi = index % 2;
+        const T& key = is_hi ? hi[index / 2] : lo[index / 2];
+
+        prefix_type &key_prefix = prefixes[index % batch_group_size];
+        if (node == root_)
+            key_prefix = make_prefix(key);
+
+        // node was reached by going right: its size is subtracted from the parent one
+        if (node->parent_ != tree_nil_ && node->parent_->right_ == node)
+            count = is_hi ? count - node->tree_size_ : count + node->tree_size_;
+
+        Order order = compare_key(key, key_prefix, node);
+        bool go_right = is_hi ? (order != Order::less) : (order == Order::greater);
+        if (!go_right)
+            return node->left_;
+
+        count = is_hi ? count + node->tree_size_ : count - node->tree_size_;
+        return node->right_;
+    });
+
+    for (std::size_t index = 0; index < result.size(); index++) {
+        if (CompT{}(hi[index], lo[index]))
+            result[index] = 0;
+    }
+}
+
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+void Tree<T, CompT, PrefixT, BalanceT, StorageT>::assign_sorted(std::span<const T> keys) {
+    clear();
+
+    // number of complete levels: nodes below them are red
+    unsigned red_depth = 0;
+    while ((std::size_t{2} << red_depth) - 1 <= keys.size())
+        red_depth++;
+
+    root_ = build_balanced(keys.data(), keys.size(), tree_nil_, 0, red_depth);
+}
+
+/*
+    Old nodes are listed in the new order, then every new node is built with the moved key.
+    Address of the new node is kept in parent_ of the old one, which is not needed anymore,
+    so children links are translated without any lookup table.
+*/
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+void Tree<T, CompT, PrefixT, BalanceT, StorageT>::compact(Layout layout) {
+    inserts_since_compact_ = 0;
+    if (root_ == tree_nil_)
+        return;
+
+    // nodes can't leave persistent storage, so it moves them itself
+    if constexpr (StorageT::persistent)
+        StorageT::compact(*this, layout);
+    else
+        compact_to_block(layout);
+}
+
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+void Tree<T, CompT, PrefixT, BalanceT, StorageT>::compact_to_block(Layout layout) {
+    std::vector<Node *> order;
+    order.reserve(size());
+
+    if (layout == Layout::depth_first) {
+        std::vector<Node *> stack = {root_};
+        while (!stack.empty()) {
+            Node *node = stack.back();
+            stack.pop_back();
+            order.push_back(node);
+
+            if (node->right_ != tree_nil_) stack.push_back(node->right_);
+            if (node->left_  != tree_nil_) stack.push_back(node->left_);
+        }
+    } else {
+        std::vector<Node *> frontier;
+        van_emde_boas_order(root_, height(), order, frontier);
+        assert(frontier.empty());
+    }
+
+    NodePool<Node> pool;
+    Node *block = pool.allocate_block(order.size());
+
+    for (std::size_t index = 0; index < order.size(); index++) {
+        Node *old_node = order[index];
+        Node *node = new (block + index) Node(std::in_place, tree_nil_, std::move(old_node->key_));
+        node->tree_size_ = old_node->tree_size_;
+        node->balance_   = old_node->balance_;
+        old_node->parent_ = node;
+    }
+
+    for (Node *old_node: order) {
+        Node *node = old_node->parent_;
+        node->left_  = (old_node->left_  == tree_nil_) ? tree_nil_ : old_node->left_->parent_;
+        node->right_ = (old_node->right_ == tree_nil_) ? tree_nil_ : old_node->right_->parent_;
+
+        if (node->left_  != tree_nil_) node->left_->parent_  = node;
+        if (node->right_ != tree_nil_) node->right_->parent_ = node;
+    }
+
+    root_ = root_->parent_;
+    for (Node *old_node: order) {
+        old_node->~Node();
+    }
+
+    // old blocks are freed with the local pool
+    std::swap(pool, pool_);
+}
+
+/*
+    Top ceil(levels / 2) levels are laid out first, then every subtree hanging below them,
+    each of them recursively. Frontier collects roots of subtrees deeper than levels.
+*/
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+void Tree<T, CompT, PrefixT, BalanceT, StorageT>::van_emde_boas_order(Node *node, std::size_t levels,
+                                                            std::vector<Node *> &order,
+                                                            std::vector<Node *> &frontier) const {
+    if (levels == 1) {
+        order.push_back(node);
+        if (node->left_  != tree_nil_) frontier.push_back(node->left_);
+        if (node->right_ != tree_nil_) frontier.push_back(node->right_);
+        return;
+    }
+
+    std::size_t top_levels = (levels + 1) / 2;
+
+    std::vector<Node *> bottoms;
+    van_emde_boas_order(node, top_levels, order, bottoms);
+    for (Node *bottom: bottoms) {
+        van_emde_boas_order(bottom, levels - top_levels, order, frontier);
+    }
+}
+
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+void Tree<T, CompT, PrefixT, BalanceT, StorageT>::clear() {
+    std::stack<Node *> stack;
+    Node * node = root_;
+
+    while (true) {
+        while (node != tree_nil_) {
+            stack.push(node);
+            node = node->left_;
+        }
+
+        if (stack.empty())
+            break;
+
+        Node * prev_node = stack.top();
+        stack.pop();
+
+        node = prev_node->right_;
+        prev_node->~Node();
     }
 
+    pool_.release();
+    root_ = tree_nil_;
+}
+
+/*
+    Copies subtree into dst in pre-order: node goes first, then its left subtree, then the right one.
+    Sizes define where each subtree starts, so both subtrees can be filled independently.
+    Explicit stack: splay trees may be O(n) deep.
+*/
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+Tree<T, CompT, PrefixT, BalanceT, StorageT>::Node *Tree<T, CompT, PrefixT, BalanceT, StorageT>::clone_subtree(const Node *src, Node *dst, Node *parent) const {
+    struct Pending {
+        const Node *src;
+        Node *dst;
+        Node *parent;
+        // link of the parent to set to the copy
+        Node **link;
+    };
+
+    Node *root = &nil_node_;
+    std::vector<Pending> stack;
+    if (src != tree_nil_)
+        stack.push_back({src, dst, parent, &root});
+
+    while (!stack.empty()) {
+        Pending cur = stack.back();
+        stack.pop_back();
+
+        Node *node = new (cur.dst) Node(cur.src->key_, cur.parent, &nil_node_, &nil_node_);
+        node->tree_size_ = cur.src->tree_size_;
+        node->balance_ = cur.src->balance_;
+        *cur.link = node;
+
+        if (cur.src->right_ != tree_nil_)
+            stack.push_back({cur.src->right_, cur.dst + 1 + cur.src->left_->tree_size_, node, &node->right_});
+        if (cur.src->left_ != tree_nil_)
+            stack.push_back({cur.src->left_, cur.dst + 1, node, &node->left_});
+    }
+
+    return root;
+}
+
+/*
+    Builds a perfectly balanced tree from sorted keys without comparisons.
+    Middle element becomes the root, so all nil leaves are on two adjacent levels.
+    Policy gets 1 for nodes on the last (incomplete) level: red-black paints them red.
+*/
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+Tree<T, CompT, PrefixT, BalanceT, StorageT>::Node *Tree<T, CompT, PrefixT, BalanceT, StorageT>::build_balanced(const T *keys, std::size_t count, Node *parent,
+                                                     unsigned depth, unsigned red_depth) {
+    if (count == 0)
+        return tree_nil_;
+
+    std::size_t mid = count / 2;
+    Node *node = create_node(keys[mid], parent);
+    node->left_  = build_balanced(keys, mid, node, depth + 1, red_depth);
+    node->right_ = build_balanced(keys + mid + 1, count - mid - 1, node, depth + 1, red_depth);
+    node->tree_size_ = count;
+    BalanceT::restore(node, depth == red_depth);
+
+    return node;
+}
+
+/*
+    Restores exact tree shape from sorted keys and per-node (depth, policy byte) pairs in one pass.
+    Tree is a cartesian tree of in-order sequence by depth, so it is built with a stack
+    of the rightmost path. Node is finished when it is popped, so sizes and policy data are set there.
+*/
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+Tree<T, CompT, PrefixT, BalanceT, StorageT>::Node *Tree<T, CompT, PrefixT, BalanceT, StorageT>::build_from_shape(const T *keys, const unsigned char *shape,
+                                                       std::size_t count) {
+    std::vector<Node *> path;
+    std::vector<std::size_t> indices;
+
+    auto pop = [&]() {
+        Node *node = path.back();
+        node->tree_size_ = 1 + node->left_->tree_size_ + node->right_->tree_size_;
+        BalanceT::restore(node, shape[2 * indices.back() + 1]);
+        path.pop_back();
+        indices.pop_back();
+        return node;
+    };
+
+    for (std::size_t i = 0; i < count; i++) {
+        unsigned char depth = shape[2 * i];
+
+        Node *node = create_node(keys[i], tree_nil_, tree_nil_, tree_nil_);
+
+        Node *last = tree_nil_;
+        while (!indices.empty() && shape[2 * indices.back()] > depth) {
+            last = pop();
+        }
+
+        node->left_ = last;
+        if (last != tree_nil_)
+            last->parent_ = node;
+
+        if (!path.empty()) {
+            path.back()->right_ = node;
+            node->parent_ = path.back();
+        }
+
+        path.push_back(node);
+        indices.push_back(i);
+    }
+
+    Node *root = tree_nil_;
+    while (!path.empty()) {
+        root = pop();
+    }
+
+    return root;
+}
+
+/// Post-order with explicit stack, heights of finished subtrees are kept in a second stack
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+bool Tree<T, CompT, PrefixT, BalanceT, StorageT>::validate_subtree(const Node *root, std::size_t &height) const {
+    // node and whether its children are already checked
+    std::vector<std::pair<const Node *, bool>> stack = {{root, false}};
+    std::vector<std::size_t> heights;
+
+    while (!stack.empty()) {
+        auto [node, children_checked] = stack.back();
+        stack.pop_back();
+
+        if (node->is_nil()) {
+            if (node->tree_size_ != 0)
+                return false;
+            heights.push_back(0);
+            continue;
+        }
+
+        if (!children_checked) {
+            stack.emplace_back(node, true);
+            stack.emplace_back(node->right_, false);
+            stack.emplace_back(node->left_, false);
+            continue;
+        }
+
+        std::size_t right_height = heights.back();
+        heights.pop_back();
+        std::size_t left_height = heights.back();
+        heights.pop_back();
+
+        if (node->left_->tree_size_ + node->right_->tree_size_ + 1 != node->tree_size_) {
+            return false;
+        }
+
+        if ((node->left_ != tree_nil_ && node->left_->parent_ != node) ||
+            (node->right_ != tree_nil_ && node->right_->parent_ != node)) {
+            return false;
+        }
+
+        std::size_t node_height = 0;
+        if (!BalanceT::check(node, left_height, right_height, node_height))
+            return false;
+        heights.push_back(node_height);
+    }
+
+    height = heights.back();
     return true;
 }
 
-template <typename T, typename CompT>
-bool Tree<T, CompT>::validate() const {
-    return validate_subtree(root_);
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+bool Tree<T, CompT, PrefixT, BalanceT, StorageT>::validate() const {
+    std::size_t height = 0;
+    return validate_subtree(root_, height);
+}
+
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+std::size_t Tree<T, CompT, PrefixT, BalanceT, StorageT>::height() const {
+    std::vector<std::pair<const Node *, std::size_t>> stack;
+    std::size_t max_depth = 0;
+
+    if (root_ != tree_nil_)
+        stack.emplace_back(root_, 1);
+
+    while (!stack.empty()) {
+        auto [node, depth] = stack.back();
+        stack.pop_back();
+        max_depth = std::max(max_depth, depth);
+
+        if (node->left_ != tree_nil_)
+            stack.emplace_back(node->left_, depth + 1);
+        if (node->right_ != tree_nil_)
+            stack.emplace_back(node->right_, depth + 1);
+    }
+
+    return max_depth;
 }
 
 } // namespace RBTree
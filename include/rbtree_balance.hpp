@@ -0,0 +1,357 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace RBTree {
+
+/*
+    Balancing policy of Tree: policy keeps its own data in every node and restores balance
+    with tree rotations, which keep subtree sizes of the order-statistic machinery up to date.
+    Tree is a friend of its policy, so hooks may call rotations and access the root.
+    Policies override only hooks they need, defaults do nothing.
+    Links of nodes may be wrappers that convert to NodeT * (see mapped_storage), so helpers
+    that take nodes get NodeT explicitly.
+    Every policy has a stable tag, files that keep node data store it (see MappedPool).
+*/
+struct balance_policy {
+    struct node_data {};
+
+    /// Called after new leaf is linked and sizes on its path are updated
+    template <typename TreeT, typename NodeT>
+    static void after_insert(TreeT &, NodeT *) {}
+
+    /// Called by non-const lookups with the last node of the search path, nil for empty tree
+    template <typename TreeT, typename NodeT>
+    static void after_access(TreeT &, NodeT *) {}
+
+    /// Byte stored for every node in snapshots
+    template <typename NodeT>
+    static unsigned char save(const NodeT *) { return 0; }
+
+    /// Sets data of a node built without inserts, both its subtrees are already complete
+    template <typename NodeT>
+    static void restore(NodeT *, unsigned char) {}
+
+    /// Checks invariant of the policy given heights of subtrees, height meaning is up to policy
+    template <typename NodeT>
+    static bool check(const NodeT *, std::size_t, std::size_t, std::size_t &height) {
+        height = 0;
+        return true;
+    }
+
+    /// Debug output
+    template <typename NodeT>
+    static std::string describe(const NodeT *) { return ""; }
+
+    template <typename NodeT>
+    static bool highlight(const NodeT *) { return false; }
+};
+
+/// Red-black tree: at most 2 log n depth, O(1) rotations per insert
+struct red_black : balance_policy {
+    static constexpr std::uint32_t tag = 1;
+
+    struct node_data {
+        bool red = false;
+    };
+
+    template <typename TreeT, typename NodeT>
+    static void after_insert(TreeT &tree, NodeT *node) {
+        node->balance_.red = true;
+
+        while (node->parent_->balance_.red)
+        {
+            if (node->parent_ == node->parent_->parent_->left_) {
+                NodeT *y = node->parent_->parent_->right_;
+                if (y->balance_.red) {
+                    node->parent_->balance_.red = false;
+                    y->balance_.red = false;
+                    node->parent_->parent_->balance_.red = true;
+                    node = node->parent_->parent_;
+                } else {
+                    if (node == node->parent_->right_) {
+                        node = node->parent_;
+                        tree.left_rotate(node);
+                    }
+                    node->parent_->balance_.red = false;
+                    node->parent_->parent_->balance_.red = true;
+                    tree.right_rotate(node->parent_->parent_);
+                }
+            }
+            else {
+                NodeT *y = node->parent_->parent_->left_;
+                if (y->balance_.red) {
+                    node->parent_->balance_.red = false;
+                    y->balance_.red = false;
+                    node->parent_->parent_->balance_.red = true;
+                    node = node->parent_->parent_;
+                } else {
+                    if (node == node->parent_->left_) {
+                        node = node->parent_;
+                        tree.right_rotate(node);
+                    }
+                    node->parent_->balance_.red = false;
+                    node->parent_->parent_->balance_.red = true;
+                    tree.left_rotate(node->parent_->parent_);
+                }
+            }
+        }
+
+        tree.root_->balance_.red = false;
+    }
+
+    template <typename NodeT>
+    static unsigned char save(const NodeT *node) { return node->balance_.red; }
+
+    template <typename NodeT>
+    static void restore(NodeT *node, unsigned char saved) { node->balance_.red = saved; }
+
+    /// Height is the black height
+    template <typename NodeT>
+    static bool check(const NodeT *node, std::size_t left_height, std::size_t right_height, std::size_t &height) {
+        height = left_height + !node->balance_.red;
+
+        // root is black, red node can't have red children and all paths have the same number of black nodes
+        if (node->balance_.red &&
+            (node->parent_->is_nil() || node->left_->balance_.red || node->right_->balance_.red)) {
+            return false;
+        }
+        return left_height == right_height;
+    }
+
+    template <typename NodeT>
+    static std::string describe(const NodeT *node) {
+        return std::string("color = ") + (node->balance_.red ? "red" : "black");
+    }
+
+    template <typename NodeT>
+    static bool highlight(const NodeT *node) { return node->balance_.red; }
+};
+
+/// AVL tree: heights of sibling subtrees differ at most by one, depth is at most 1.44 log n
+struct avl : balance_policy {
+    static constexpr std::uint32_t tag = 2;
+
+    struct node_data {
+        // nil has zero height
+        std::uint8_t height = 0;
+    };
+
+    template <typename NodeT>
+    static int height(const NodeT *node) { return node->balance_.height; }
+
+    template <typename NodeT>
+    static void update(NodeT *node) {
+        node->balance_.height = static_cast<std::uint8_t>(1 + std::max(height<NodeT>(node->left_), height<NodeT>(node->right_)));
+    }
+
+    /// Rotation restores height the subtree had before insert, so upper nodes need no changes
+    template <typename TreeT, typename NodeT>
+    static void after_insert(TreeT &tree, NodeT *node) {
+        node->balance_.height = 1;
+
+        for (NodeT *cur = node->parent_; !cur->is_nil(); cur = cur->parent_) {
+            int old_height = height(cur);
+            update(cur);
+
+            int balance = height<NodeT>(cur->left_) - height<NodeT>(cur->right_);
+            if (balance > 1) {
+                NodeT *child = cur->left_;
+                if (height<NodeT>(child->left_) < height<NodeT>(child->right_)) {
+                    tree.left_rotate(child);
+                    update(child);
+                    update<NodeT>(child->parent_);
+                }
+                tree.right_rotate(cur);
+                update(cur);
+                update<NodeT>(cur->parent_);
+                return;
+            }
+            if (balance < -1) {
+                NodeT *child = cur->right_;
+                if (height<NodeT>(child->right_) < height<NodeT>(child->left_)) {
+                    tree.right_rotate(child);
+                    update(child);
+                    update<NodeT>(child->parent_);
+                }
+                tree.left_rotate(cur);
+                update(cur);
+                update<NodeT>(cur->parent_);
+                return;
+            }
+
+            if (height(cur) == old_height)
+                return;
+        }
+    }
+
+    template <typename NodeT>
+    static void restore(NodeT *node, unsigned char) { update(node); }
+
+    template <typename NodeT>
+    static bool check(const NodeT *node, std::size_t left_height, std::size_t right_height, std::size_t &height) {
+        height = 1 + std::max(left_height, right_height);
+        return node->balance_.height == height &&
+               std::max(left_height, right_height) - std::min(left_height, right_height) <= 1;
+    }
+
+    template <typename NodeT>
+    static std::string describe(const NodeT *node) {
+        return "height = " + std::to_string(node->balance_.height);
+    }
+};
+
+/*
+    Treap: binary heap on random priorities, expected depth is O(log n).
+    Nodes built without inserts get priorities one above their children, so they are
+    below all new nodes: new keys split the restored tree, which keeps depth logarithmic.
+*/
+struct treap : balance_policy {
+    static constexpr std::uint32_t tag = 3;
+
+    struct node_data {
+        // nil has the lowest priority
+        std::uint32_t priority = 0;
+    };
+
+    /// xorshift32, deterministic so runs are reproducible
+    static std::uint32_t next_priority() {
+        thread_local std::uint32_t state = 0x9E3779B9u;
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state | 1;
+    }
+
+    template <typename TreeT, typename NodeT>
+    static void after_insert(TreeT &tree, NodeT *node) {
+        node->balance_.priority = next_priority();
+
+        while (!node->parent_->is_nil() && node->parent_->balance_.priority < node->balance_.priority) {
+            if (node == node->parent_->left_)
+                tree.right_rotate(node->parent_);
+            else
+                tree.left_rotate(node->parent_);
+        }
+    }
+
+    template <typename NodeT>
+    static void restore(NodeT *node, unsigned char) {
+        node->balance_.priority = 1 + std::max(node->left_->balance_.priority, node->right_->balance_.priority);
+    }
+
+    template <typename NodeT>
+    static bool check(const NodeT *node, std::size_t, std::size_t, std::size_t &height) {
+        height = 0;
+        return node->balance_.priority >= node->left_->balance_.priority &&
+               node->balance_.priority >= node->right_->balance_.priority;
+    }
+
+    template <typename NodeT>
+    static std::string describe(const NodeT *node) {
+        return "priority = " + std::to_string(node->balance_.priority);
+    }
+};
+
+/*
+    Splay tree: inserted and looked up nodes are moved to the root, so hot keys stay near it.
+    Amortized O(log n), but single operations may take O(n).
+    Only non-const lookups splay: const ones leave the tree as is, so they don't get the
+    amortized bound and concurrent readers must use them through a const reference.
+*/
+struct splay : balance_policy {
+    static constexpr std::uint32_t tag = 4;
+
+    /// Rotates node above its parent
+    template <typename TreeT, typename NodeT>
+    static void rotate_up(TreeT &tree, NodeT *node) {
+        if (node == node->parent_->left_)
+            tree.right_rotate(node->parent_);
+        else
+            tree.left_rotate(node->parent_);
+    }
+
+    template <typename TreeT, typename NodeT>
+    static void splay_node(TreeT &tree, NodeT *node) {
+        while (!node->parent_->is_nil()) {
+            NodeT *parent = node->parent_;
+            NodeT *grand  = parent->parent_;
+
+            if (grand->is_nil()) {
+                rotate_up(tree, node);
+            } else if ((node == parent->left_) == (parent == grand->left_)) {
+                // zig-zig
+                rotate_up(tree, parent);
+                rotate_up(tree, node);
+            } else {
+                // zig-zag
+                rotate_up(tree, node);
+                rotate_up(tree, node);
+            }
+        }
+    }
+
+    template <typename TreeT, typename NodeT>
+    static void after_insert(TreeT &tree, NodeT *node) { splay_node(tree, node); }
+
+    template <typename TreeT, typename NodeT>
+    static void after_access(TreeT &tree, NodeT *node) {
+        if (!node->is_nil())
+            splay_node(tree, node);
+    }
+};
+
+/*
+    Weight-balanced tree (BB[alpha]) on subtree sizes the tree keeps anyway, so nodes store nothing.
+    Weights of siblings (size + 1) differ at most delta times, rotation is double
+    if inner grandchild is ratio times heavier than outer one. (delta, ratio) = (3, 2) as in Adams' sets.
+*/
+struct weight_balanced : balance_policy {
+    static constexpr std::uint32_t tag = 5;
+
+    static constexpr std::size_t delta = 3;
+    static constexpr std::size_t ratio = 2;
+
+    template <typename NodeT>
+    static std::size_t weight(const NodeT *node) { return node->tree_size_ + 1; }
+
+    /// True if heavy subtree is not too heavy compared to light one
+    template <typename NodeT>
+    static bool balanced(const NodeT *light, const NodeT *heavy) {
+        return weight(heavy) <= delta * weight(light);
+    }
+
+    template <typename TreeT, typename NodeT>
+    static void after_insert(TreeT &tree, NodeT *node) {
+        NodeT *cur = node->parent_;
+        while (!cur->is_nil()) {
+            // rotations move cur down, its parent stays next on the path
+            NodeT *next = cur->parent_;
+
+            if (!balanced<NodeT>(cur->left_, cur->right_)) {
+                NodeT *child = cur->right_;
+                if (weight<NodeT>(child->left_) >= ratio * weight<NodeT>(child->right_))
+                    tree.right_rotate(child);
+                tree.left_rotate(cur);
+            } else if (!balanced<NodeT>(cur->right_, cur->left_)) {
+                NodeT *child = cur->left_;
+                if (weight<NodeT>(child->right_) >= ratio * weight<NodeT>(child->left_))
+                    tree.left_rotate(child);
+                tree.right_rotate(cur);
+            }
+
+            cur = next;
+        }
+    }
+
+    template <typename NodeT>
+    static bool check(const NodeT *node, std::size_t, std::size_t, std::size_t &height) {
+        height = 0;
+        return balanced<NodeT>(node->left_, node->right_) && balanced<NodeT>(node->right_, node->left_);
+    }
+};
+
+} // namespace RBTree
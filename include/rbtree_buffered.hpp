@@ -0,0 +1,286 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+#include "rbtree.hpp"
+
+namespace RBTree {
+
+/*
+    Write-optimized front end of a tree: inserts are appended to an unsorted buffer and
+    reach the tree in batches, when buffer holds capacity keys or on flush().
+
+    Batch is sorted and deduplicated. Small batches are inserted in one pass by
+    Tree::insert_sorted, where each search starts from the previous key. Batches comparable
+    to the tree are merged with its keys and the tree is rebuilt in O(n) by Tree::assign_sorted.
+
+    Queries either flush the buffer (QueryMode::flush) or count buffered keys with
+    binary search (QueryMode::merge). In merge mode keys appended since the last query become
+    a sorted run. Runs are merged when a newer one reaches half of the older size, so there are
+    O(log capacity) of them and each key is merged O(log capacity) times, however often queries come.
+    Buffered keys may already be in the tree or in an older run: a key is looked up only when
+    a query first covers it, keys of one run are looked up in the tree in one pass in key order.
+*/
+template <typename T, typename CompT = std::less<T>, typename PrefixT = no_key_prefix,
+          typename BalanceT = red_black>
+class BufferedTree {
+public:
+    using TreeT = Tree<T, CompT, PrefixT, BalanceT>;
+
+    enum class QueryMode {
+        merge,
+        flush,
+    };
+
+    static constexpr std::size_t default_capacity = 1024;
+
+private:
+    enum class Presence : std::uint8_t {
+        unknown,
+        absent,
+        in_tree,
+        // in an older run, counted there
+        duplicate,
+    };
+
+    struct Entry {
+        T key_;
+        Presence presence_;
+    };
+
+    TreeT &tree_;
+
+    std::size_t capacity_;
+    QueryMode mode_;
+
+    // appended keys, not sorted yet
+    std::vector<T> pending_;
+
+    // sorted runs of unique keys, sizes decrease; runs may share keys until they are merged
+    std::vector<std::vector<Entry>> runs_;
+    std::size_t staged_ = 0;
+
+    // keys of the batch being flushed
+    std::vector<T> batch_;
+
+    static bool equal(const T& lhs, const T& rhs) { return !CompT{}(lhs, rhs) && !CompT{}(rhs, lhs); }
+
+    static bool entry_less(const Entry& lhs, const Entry& rhs) { return CompT{}(lhs.key_, rhs.key_); }
+
+    static void sort_unique(std::vector<T> &keys) {
+        std::sort(keys.begin(), keys.end(), CompT{});
+        keys.erase(std::unique(keys.begin(), keys.end(), equal), keys.end());
+    }
+
+    /// First entry of run not less than key
+    static typename std::vector<Entry>::iterator find(std::vector<Entry> &run, const T& key) {
+        return std::lower_bound(run.begin(), run.end(), key,
+                                [](const Entry &entry, const T& bound) { return CompT{}(entry.key_, bound); });
+    }
+
+    bool in_older_run(std::size_t run_index, const T& key) {
+        for (std::size_t index = 0; index < run_index; index++) {
+            auto it = find(runs_[index], key);
+            if (it != runs_[index].end() && equal(it->key_, key))
+                return true;
+        }
+        return false;
+    }
+
+    /// Union of two runs, presence of the older copy of a key is kept unless it is unknown
+    static std::vector<Entry> merge_runs(const std::vector<Entry> &older, const std::vector<Entry> &newer);
+
+    /// Moves pending keys to a new run
+    void stage();
+
+    /// Rebuild reads every key of the tree, inserts pay a search per key
+    bool rebuild_is_cheaper(std::size_t batch) const {
+        std::size_t tree_size = tree_.size();
+        return batch * std::bit_width(tree_size) >= tree_size;
+    }
+
+public:
+    /// Tree must outlive the buffer and must not be modified directly while keys are buffered
+    explicit BufferedTree(TreeT &tree, std::size_t capacity = default_capacity, QueryMode mode = QueryMode::flush)
+        : tree_(tree), capacity_(std::max<std::size_t>(capacity, 1)), mode_(mode), pending_(), runs_(), batch_() {
+        pending_.reserve(capacity_);
+    }
+
+    BufferedTree(const BufferedTree& rhs) = delete;
+    BufferedTree &operator=(const BufferedTree& rhs) = delete;
+
+    void insert(const T& key) {
+        pending_.push_back(key);
+        if (pending_.size() + staged_ >= capacity_)
+            flush();
+    }
+
+    /// Writes all buffered keys to the tree
+    void flush();
+
+    /// Number of keys in [lo, hi], including buffered ones
+    std::size_t count_range(const T& lo, const T& hi);
+
+    /// Number of keys, buffered keys are flushed to count them
+    std::size_t size() {
+        flush();
+        return tree_.size();
+    }
+
+    /// Number of buffered keys, some of them may be in the tree already
+    std::size_t buffered() const { return pending_.size() + staged_; }
+};
+
+template <typename T, typename CompT, typename PrefixT, typename BalanceT>
+std::vector<typename BufferedTree<T, CompT, PrefixT, BalanceT>::Entry>
+BufferedTree<T, CompT, PrefixT, BalanceT>::merge_runs(const std::vector<Entry> &older, const std::vector<Entry> &newer) {
+    std::vector<Entry> merged;
+    merged.reserve(older.size() + newer.size());
+
+    auto older_it = older.begin(), newer_it = newer.begin();
+    while (older_it != older.end() && newer_it != newer.end()) {
+        if (entry_less(*older_it, *newer_it)) {
+            merged.push_back(*older_it++);
+        } else if (entry_less(*newer_it, *older_it)) {
+            merged.push_back(*newer_it++);
+        } else {
+            merged.push_back(*older_it);
+            if (older_it->presence_ == Presence::unknown && newer_it->presence_ != Presence::duplicate)
+                merged.back().presence_ = newer_it->presence_;
+            ++older_it;
+            ++newer_it;
+        }
+    }
+    merged.insert(merged.end(), older_it, older.end());
+    merged.insert(merged.end(), newer_it, newer.end());
+
+    return merged;
+}
+
+template <typename T, typename CompT, typename PrefixT, typename BalanceT>
+void BufferedTree<T, CompT, PrefixT, BalanceT>::stage() {
+    if (pending_.empty())
+        return;
+
+    sort_unique(pending_);
+
+    std::vector<Entry> run;
+    run.reserve(pending_.size());
+    for (const T& key: pending_) run.push_back(Entry{key, Presence::unknown});
+    pending_.clear();
+
+    staged_ += run.size();
+    runs_.push_back(std::move(run));
+
+    while (runs_.size() > 1 && runs_[runs_.size() - 2].size() <= 2 * runs_.back().size()) {
+        std::vector<Entry> merged = merge_runs(runs_[runs_.size() - 2], runs_.back());
+
+        staged_ -= runs_[runs_.size() - 2].size() + runs_.back().size() - merged.size();
+        runs_.pop_back();
+        runs_.back().swap(merged);
+    }
+}
+
+template <typename T, typename CompT, typename PrefixT, typename BalanceT>
+void BufferedTree<T, CompT, PrefixT, BalanceT>::flush() {
+    // buffers are reused, so frequent small flushes don't allocate
+    std::vector<T> &batch = batch_;
+    batch.swap(pending_);
+    for (const std::vector<Entry> &run: runs_) {
+        for (const Entry &entry: run) {
+            if (entry.presence_ == Presence::unknown || entry.presence_ == Presence::absent)
+                batch.push_back(entry.key_);
+        }
+    }
+    runs_.clear();
+    staged_ = 0;
+
+    if (batch.empty())
+        return;
+
+    sort_unique(batch);
+
+    if (!rebuild_is_cheaper(batch.size())) {
+        tree_.insert_sorted(batch);
+        batch.clear();
+        return;
+    }
+
+    // merge tree keys with the batch, keys present in both are taken once
+    std::vector<T> keys;
+    keys.reserve(tree_.size() + batch.size());
+
+    typename TreeT::iterator it = tree_.begin();
+    auto batch_it = batch.begin();
+    while (!it.is_end() || batch_it != batch.end()) {
+        if (batch_it == batch.end() || (!it.is_end() && CompT{}(*it, *batch_it))) {
+            keys.push_back(*it);
+            ++it;
+        } else {
+            if (!it.is_end() && equal(*it, *batch_it))
+                ++it;
+            keys.push_back(*batch_it);
+            ++batch_it;
+        }
+    }
+
+    tree_.assign_sorted(keys);
+    batch.clear();
+}
+
+/*
+    Buffered keys of [lo, hi] are visited run by run in key order together with a tree iterator:
+    iterator steps forward over short gaps and jumps with lower_bound over long ones,
+    so a key costs at most one search when it is seen first and a comparison later.
+*/
+template <typename T, typename CompT, typename PrefixT, typename BalanceT>
+std::size_t BufferedTree<T, CompT, PrefixT, BalanceT>::count_range(const T& lo, const T& hi) {
+    if (CompT{}(hi, lo))
+        return 0;
+
+    if (mode_ == QueryMode::flush) {
+        flush();
+        return tree_.count_range(lo, hi);
+    }
+
+    stage();
+
+    const std::size_t max_steps = std::bit_width(tree_.size());
+    std::size_t count = tree_.count_range(lo, hi);
+
+    for (std::size_t run_index = 0; run_index < runs_.size(); run_index++) {
+        typename TreeT::iterator it = tree_.end();
+        bool positioned = false;
+
+        for (auto entry = find(runs_[run_index], lo); entry != runs_[run_index].end() && !CompT{}(hi, entry->key_); ++entry) {
+            if (entry->presence_ == Presence::unknown) {
+                const T& key = entry->key_;
+
+                std::size_t steps = 0;
+                while (positioned && !it.is_end() && CompT{}(*it, key) && steps++ < max_steps) ++it;
+                if (!positioned || (!it.is_end() && CompT{}(*it, key))) {
+                    it = tree_.lower_bound(key);
+                    positioned = true;
+                }
+
+                if (!it.is_end() && equal(*it, key))
+                    entry->presence_ = Presence::in_tree;
+                else if (in_older_run(run_index, key))
+                    entry->presence_ = Presence::duplicate;
+                else
+                    entry->presence_ = Presence::absent;
+            }
+
+            count += (entry->presence_ == Presence::absent);
+        }
+    }
+
+    return count;
+}
+
+} // namespace RBTree
@@ -0,0 +1,252 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <map>
+#include <memory>
+#include <utility>
+
+#include "rbtree.hpp"
+#include "rbtree_balance.hpp"
+
+namespace RBTree {
+
+/*
+    Interval index: intervals [lo, hi] with ids, reports all intervals containing a key.
+    Treap ordered by (lo, id) where every node keeps maximum hi of its subtree, so
+    subtrees that end before the key are skipped: stabbing query is O(log n + answer).
+    Insert and erase restructure only the subtree below the new or erased node, expected O(1) nodes.
+*/
+template <typename T, typename CompT, typename IdT>
+class IntervalIndex {
+    struct Node {
+        T lo_, hi_;
+        IdT id_;
+        std::uint32_t priority_ = treap::next_priority();
+
+        // maximum hi in subtree
+        T max_hi_;
+
+        std::unique_ptr<Node> left_  = nullptr;
+        std::unique_ptr<Node> right_ = nullptr;
+
+        Node(const T& lo, const T& hi, IdT id) : lo_(lo), hi_(hi), id_(id), max_hi_(hi) {}
+
+        Node(const Node& rhs) = delete;
+        Node &operator=(const Node& rhs) = delete;
+    };
+
+    using Link = std::unique_ptr<Node>;
+
+    Link root_ = nullptr;
+
+    static const T& max(const T& lhs, const T& rhs) { return CompT{}(lhs, rhs) ? rhs : lhs; }
+
+    static void update(Node *node) {
+        node->max_hi_ = node->hi_;
+        if (node->left_)  node->max_hi_ = max(node->max_hi_, node->left_->max_hi_);
+        if (node->right_) node->max_hi_ = max(node->max_hi_, node->right_->max_hi_);
+    }
+
+    static bool less(const Node *node, const T& lo, IdT id) {
+        return CompT{}(node->lo_, lo) || (!CompT{}(lo, node->lo_) && std::less<IdT>{}(node->id_, id));
+    }
+
+    /// Splits tree into nodes less than (lo, id) and the rest
+    static std::pair<Link, Link> split(Link node, const T& lo, IdT id) {
+        if (!node)
+            return {nullptr, nullptr};
+
+        if (less(node.get(), lo, id)) {
+            auto [left, right] = split(std::move(node->right_), lo, id);
+            node->right_ = std::move(left);
+            update(node.get());
+            return {std::move(node), std::move(right)};
+        }
+
+        auto [left, right] = split(std::move(node->left_), lo, id);
+        node->left_ = std::move(right);
+        update(node.get());
+        return {std::move(left), std::move(node)};
+    }
+
+    /// All keys of left are less than keys of right
+    static Link merge(Link left, Link right) {
+        if (!left)  return right;
+        if (!right) return left;
+
+        if (left->priority_ > right->priority_) {
+            left->right_ = merge(std::move(left->right_), std::move(right));
+            update(left.get());
+            return left;
+        }
+
+        right->left_ = merge(std::move(left), std::move(right->left_));
+        update(right.get());
+        return right;
+    }
+
+    template <typename Fn>
+    static void stab(const Node *node, const T& key, Fn &fn) {
+        if (!node || CompT{}(node->max_hi_, key))
+            return;
+
+        stab(node->left_.get(), key, fn);
+
+        // right subtree starts not before this node
+        if (CompT{}(key, node->lo_))
+            return;
+
+        if (!CompT{}(node->hi_, key))
+            fn(node->id_);
+        stab(node->right_.get(), key, fn);
+    }
+
+    /// New node goes down to the first node of lower priority, only subtree below it is split
+    static void insert(Link &link, Link &node) {
+        if (!link || link->priority_ < node->priority_) {
+            auto [left, right] = split(std::move(link), node->lo_, node->id_);
+            node->left_  = std::move(left);
+            node->right_ = std::move(right);
+            update(node.get());
+            link = std::move(node);
+            return;
+        }
+
+        link->max_hi_ = max(link->max_hi_, node->hi_);
+        insert(less(link.get(), node->lo_, node->id_) ? link->right_ : link->left_, node);
+    }
+
+    /// Erased node is replaced by merge of its children
+    static void erase(Link &link, const T& lo, IdT id) {
+        if (!link)
+            return;
+
+        if (less(link.get(), lo, id)) {
+            erase(link->right_, lo, id);
+        } else if (CompT{}(lo, link->lo_) || link->id_ != id) {
+            erase(link->left_, lo, id);
+        } else {
+            link = merge(std::move(link->left_), std::move(link->right_));
+            return;
+        }
+        update(link.get());
+    }
+
+public:
+    void insert(const T& lo, const T& hi, IdT id) {
+        Link node = std::make_unique<Node>(lo, hi, id);
+        insert(root_, node);
+    }
+
+    void erase(const T& lo, IdT id) { erase(root_, lo, id); }
+
+    /// Calls fn(id) for every interval that contains key
+    template <typename Fn>
+    void for_each_containing(const T& key, Fn fn) const { stab(root_.get(), key, fn); }
+};
+
+/*
+    Memoizes range counts of a tree by (lo, hi) for workloads that repeat the same queries.
+    Inserts that go through the cache keep cached counts exact: every cached range that
+    contains the new key is found with the interval index and its count is incremented.
+    At most capacity ranges are kept, least recently used one is evicted.
+*/
+template <typename T, typename CompT = std::less<T>, typename PrefixT = no_key_prefix,
+          typename BalanceT = red_black>
+class RangeCountCache {
+public:
+    using TreeT = Tree<T, CompT, PrefixT, BalanceT>;
+
+    static constexpr std::size_t default_capacity = 1024;
+
+private:
+    struct Entry {
+        T lo_, hi_;
+        std::size_t count_;
+    };
+
+    struct RangeLess {
+        bool operator()(const std::pair<T, T> &lhs, const std::pair<T, T> &rhs) const {
+            return CompT{}(lhs.first, rhs.first) ||
+                   (!CompT{}(rhs.first, lhs.first) && CompT{}(lhs.second, rhs.second));
+        }
+    };
+
+    TreeT &tree_;
+    std::size_t capacity_;
+
+    // most recently used first
+    std::list<Entry> entries_;
+    std::map<std::pair<T, T>, typename std::list<Entry>::iterator, RangeLess> lookup_;
+    IntervalIndex<T, CompT, Entry *> index_;
+
+    std::size_t hits_   = 0;
+    std::size_t misses_ = 0;
+
+public:
+    /// Tree must outlive the cache and must be modified only through it while cache is used
+    explicit RangeCountCache(TreeT &tree, std::size_t capacity = default_capacity)
+        : tree_(tree), capacity_(capacity), entries_(), lookup_(), index_() {}
+
+    RangeCountCache(const RangeCountCache& rhs) = delete;
+    RangeCountCache &operator=(const RangeCountCache& rhs) = delete;
+
+    bool insert(const T& key) {
+        if (!tree_.insert(key))
+            return false;
+
+        index_.for_each_containing(key, [](Entry *entry) { entry->count_++; });
+        return true;
+    }
+
+    /// Number of keys in [lo, hi]
+    std::size_t count_range(const T& lo, const T& hi);
+
+    std::size_t hits()   const { return hits_; }
+    std::size_t misses() const { return misses_; }
+    std::size_t size()   const { return entries_.size(); }
+};
+
+template <typename T, typename CompT, typename PrefixT, typename BalanceT>
+std::size_t RangeCountCache<T, CompT, PrefixT, BalanceT>::count_range(const T& lo, const T& hi) {
+    if (CompT{}(hi, lo))
+        return 0;
+
+    auto found = lookup_.find({lo, hi});
+    if (found != lookup_.end()) {
+        hits_++;
+        entries_.splice(entries_.begin(), entries_, found->second);
+        return found->second->count_;
+    }
+
+    misses_++;
+    std::size_t count = tree_.count_range(lo, hi);
+    if (capacity_ == 0)
+        return count;
+
+    if (entries_.size() < capacity_) {
+        entries_.push_front(Entry{lo, hi, count});
+        lookup_.emplace(std::pair<T, T>(lo, hi), entries_.begin());
+        index_.insert(lo, hi, &entries_.front());
+        return count;
+    }
+
+    // least recently used entry and its lookup node are reused for the new range
+    Entry &entry = entries_.back();
+    index_.erase(entry.lo_, &entry);
+    auto lookup_node = lookup_.extract({entry.lo_, entry.hi_});
+
+    entries_.splice(entries_.begin(), entries_, std::prev(entries_.end()));
+    entry = Entry{lo, hi, count};
+    lookup_node.key() = {lo, hi};
+    lookup_.insert(std::move(lookup_node));
+    index_.insert(lo, hi, &entry);
+
+    return count;
+}
+
+} // namespace RBTree
@@ -1,66 +1,94 @@
 #pragma once
 
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "rbtree.hpp"
 
 namespace RBTree {
 
-template <typename T, typename CompT>
-void Tree<T, CompT>::print_sorted(std::ostream &stream, const iterator it) const {
+// all traversals use explicit stacks: splay trees may be O(n) deep
+
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+void Tree<T, CompT, PrefixT, BalanceT, StorageT>::print_sorted(std::ostream &stream, const iterator it) const {
+    std::vector<const Node *> stack;
     const Node *node = it.ptr_;
-    if (node == tree_nil_)
-        return;
 
-    print_sorted(stream,  node->left_);
-    stream << node->key_ << " ";
-    print_sorted(stream, node->right_);
+    while (true) {
+        while (node != tree_nil_) {
+            stack.push_back(node);
+            node = node->left_;
+        }
+
+        if (stack.empty())
+            break;
+
+        node = stack.back();
+        stack.pop_back();
+        stream << node->key_ << " ";
+        node = node->right_;
+    }
 }
 
-template <typename T, typename CompT>
-void Tree<T, CompT>::print_debug(std::ostream &stream, const iterator it, const unsigned indent) const {
-    const Node *node = it.ptr_;
-    if (node == tree_nil_)
-        return;
-
-    std::string indent_str(indent, '\t');
-
-    stream << indent_str << "Node " << node << ":\n";
-    stream << indent_str << "color = " << ((node->color_ == Color::black) ? "black" : "red") << "\n";
-    stream << indent_str << "key = " << node->key_ << "\n";
-    stream << indent_str << "parent " << node->parent_ << "\n";
-    stream << indent_str << "left   " << node->left_   << "\n";
-    stream << indent_str << "right  " << node->right_  << "\n";
-    print_debug(stream, node->left_, indent + 1);
-    print_debug(stream, node->right_, indent + 1);
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+void Tree<T, CompT, PrefixT, BalanceT, StorageT>::print_debug(std::ostream &stream, const iterator it, const unsigned indent) const {
+    std::vector<std::pair<const Node *, unsigned>> stack = {{it.ptr_, indent}};
+
+    while (!stack.empty()) {
+        auto [node, depth] = stack.back();
+        stack.pop_back();
+        if (node == tree_nil_)
+            continue;
+
+        std::string indent_str(depth, '\t');
+
+        stream << indent_str << "Node " << node << ":\n";
+        std::string balance = BalanceT::describe(node);
+        if (!balance.empty())
+            stream << indent_str << balance << "\n";
+        stream << indent_str << "key = " << node->key_ << "\n";
+        stream << indent_str << "parent " << node->parent_ << "\n";
+        stream << indent_str << "left   " << node->left_   << "\n";
+        stream << indent_str << "right  " << node->right_  << "\n";
+
+        stack.emplace_back(node->right_, depth + 1);
+        stack.emplace_back(node->left_, depth + 1);
+    }
 }
 
-template <typename T, typename CompT>
-void Tree<T, CompT>::print_dot_debug_recursive(std::ostream &stream, const Node *node) const {
-    if (node == tree_nil_)
-        return;
-
-    std::string fillcolor = (node->color_ == Color::black) ? "#D5D5D5FF": "#F54927";
-    stream << "\t" << "node" << node << "[shape = Mrecord, label = \"{"
-            << "node[" << node << "] | parent[" << node->parent_ << "] | "
-            << node->key_ << " | "
-            << "{<left> L | <right> R}}\""
-            << ", style = filled, fillcolor = \"" << fillcolor << "\"];\n";
-
-    if (node->left_ != tree_nil_)
-        stream << "\tnode" << node << ":<left> -> node" << node->left_ << ";\n";
-    if (node->right_ != tree_nil_)
-        stream << "\tnode" << node << ":<right> -> node" << node->right_ << ";\n";
-
-    print_dot_debug_recursive(stream, node->left_);
-    print_dot_debug_recursive(stream, node->right_);
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+void Tree<T, CompT, PrefixT, BalanceT, StorageT>::print_dot_debug_nodes(std::ostream &stream, const Node *root) const {
+    std::vector<const Node *> stack = {root};
+
+    while (!stack.empty()) {
+        const Node *node = stack.back();
+        stack.pop_back();
+        if (node == tree_nil_)
+            continue;
+
+        std::string fillcolor = BalanceT::highlight(node) ? "#F54927" : "#D5D5D5FF";
+        stream << "\t" << "node" << node << "[shape = Mrecord, label = \"{"
+                << "node[" << node << "] | parent[" << node->parent_ << "] | "
+                << node->key_ << " | "
+                << "{<left> L | <right> R}}\""
+                << ", style = filled, fillcolor = \"" << fillcolor << "\"];\n";
+
+        if (node->left_ != tree_nil_)
+            stream << "\tnode" << node << ":<left> -> node" << node->left_ << ";\n";
+        if (node->right_ != tree_nil_)
+            stream << "\tnode" << node << ":<right> -> node" << node->right_ << ";\n";
+
+        stack.push_back(node->right_);
+        stack.push_back(node->left_);
+    }
 }
 
-template <typename T, typename CompT>
-void Tree<T, CompT>::print_dot_debug(std::ostream &stream, const iterator it) const {
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+void Tree<T, CompT, PrefixT, BalanceT, StorageT>::print_dot_debug(std::ostream &stream, const iterator it) const {
     stream << "digraph {\n"
               "graph [splines=line]\n";
-    print_dot_debug_recursive(stream, it.ptr_);
+    print_dot_debug_nodes(stream, it.ptr_);
     stream << "}\n";
 }
 
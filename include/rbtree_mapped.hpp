@@ -0,0 +1,581 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "rbtree.hpp"
+
+namespace RBTree {
+
+/*
+    Link of a node in a mapped file: signed distance in bytes from the link to the target node,
+    so links stay valid wherever the file is mapped. Zero stands for the nil sentinel,
+    which lives in the program and not in the file.
+*/
+template <typename NodeT, typename OffsetT>
+class offset_link {
+    using distance_type = std::make_signed_t<OffsetT>;
+
+    distance_type distance_ = 0;
+
+    constexpr void set(NodeT *node) {
+        if (node == NodeT::nil() || node == nullptr) {
+            distance_ = 0;
+            return;
+        }
+        distance_ = static_cast<distance_type>(reinterpret_cast<std::intptr_t>(node) -
+                                               reinterpret_cast<std::intptr_t>(this));
+    }
+
+public:
+    constexpr offset_link(NodeT *node = nullptr) { set(node); }
+
+    // copies point to the same node, not to the same distance
+    offset_link(const offset_link& rhs) { set(rhs); }
+    offset_link &operator=(const offset_link& rhs) {
+        set(rhs);
+        return *this;
+    }
+
+    offset_link &operator=(NodeT *node) {
+        set(node);
+        return *this;
+    }
+
+    operator NodeT *() const {
+        if (distance_ == 0)
+            return NodeT::nil();
+        return reinterpret_cast<NodeT *>(reinterpret_cast<std::intptr_t>(this) + distance_);
+    }
+
+    NodeT *operator->() const { return *this; }
+
+    /// While nodes are moved links hold file offsets of their targets instead, 0 for nil
+    std::size_t file_offset() const { return static_cast<std::size_t>(distance_); }
+    void set_file_offset(std::size_t offset) { distance_ = static_cast<distance_type>(offset); }
+};
+
+/*
+    Node pool in a memory-mapped file:
+    | FileHeader | page | page | ...
+    Every page starts with a PageHeader followed by nodes. New node is placed to the page
+    of its parent when possible, relayout() clusters all nodes into pages by subtrees.
+
+    Address range the file may grow to is reserved when it is opened, so the mapping
+    never moves and node pointers stay valid until the file is closed.
+*/
+template <typename NodeT, typename OffsetT>
+class MappedPool {
+    struct FileHeader {
+        char          magic[8];
+        std::uint32_t version;
+        std::uint32_t key_size;
+        std::uint32_t offset_size;
+        std::uint32_t node_size;
+        // tag of the balancing policy, its data is kept in nodes
+        std::uint32_t balance;
+        // 1 if the file was closed, 0 while it is open or after a crash
+        std::uint32_t closed;
+        std::uint64_t page_size;
+        std::uint64_t page_count;
+        std::uint64_t last_page;
+        // offset of the root node, 0 for empty tree
+        std::uint64_t root;
+    };
+
+    struct PageHeader {
+        std::uint64_t used;
+    };
+
+    static constexpr char          file_magic[8] = {'R', 'B', 'T', 'M', 'A', 'P', '\0', '\0'};
+    static constexpr std::uint32_t file_version  = 3;
+
+    static constexpr std::size_t page_size     = 4096;
+    static constexpr std::size_t initial_pages = 16;
+
+    static constexpr std::size_t first_node =
+        (sizeof(PageHeader) + alignof(NodeT) - 1) / alignof(NodeT) * alignof(NodeT);
+
+    // links reach only as far as their signed distance does
+    static constexpr std::size_t max_file_size =
+        std::min<std::uint64_t>(std::numeric_limits<std::make_signed_t<OffsetT>>::max(), std::uint64_t{1} << 40) /
+        page_size * page_size;
+
+    static_assert(sizeof(FileHeader) <= page_size, "File header is too large for a page");
+
+public:
+    static constexpr std::size_t page_capacity = (page_size - first_node) / sizeof(NodeT);
+    static_assert(page_capacity > 0, "Node is too large for a page");
+
+private:
+    int fd_ = -1;
+    unsigned char *base_ = nullptr;
+    std::size_t mapped_size_ = 0;
+
+    // file is marked open, close() marks it closed
+    bool marked_open_ = false;
+
+    FileHeader &header() const { return *reinterpret_cast<FileHeader *>(base_); }
+    PageHeader &page(std::size_t page_offset) const { return *reinterpret_cast<PageHeader *>(base_ + page_offset); }
+
+    std::size_t offset_of(const NodeT *node) const {
+        return static_cast<std::size_t>(reinterpret_cast<const unsigned char *>(node) - base_);
+    }
+
+    NodeT *node_at(std::size_t offset) const { return reinterpret_cast<NodeT *>(base_ + offset); }
+
+    static constexpr std::size_t slot_offset(std::size_t page_index, std::size_t slot) {
+        return page_index * page_size + first_node + slot * sizeof(NodeT);
+    }
+
+    /// Maps file up to size within the reserved range
+    bool grow(std::size_t size);
+
+    /// Writes closed flag of the header to disk, data must be flushed before marking file closed
+    void mark(bool closed) {
+        header().closed = closed;
+        msync(base_, page_size, MS_SYNC);
+        marked_open_ = !closed;
+    }
+
+    /// Next free slot of the page or nullptr if it is full
+    NodeT *take(std::size_t page_offset) {
+        PageHeader &page_header = page(page_offset);
+        if (page_header.used == page_capacity)
+            return nullptr;
+
+        return reinterpret_cast<NodeT *>(base_ + page_offset + first_node + sizeof(NodeT) * page_header.used++);
+    }
+
+    /// Places new node near parent (nil for none), throws std::bad_alloc if file can't grow
+    NodeT *allocate(const NodeT *parent);
+
+public:
+    MappedPool() = default;
+    ~MappedPool() { close(); }
+
+    MappedPool(const MappedPool& rhs) = delete;
+    MappedPool &operator=(const MappedPool& rhs) = delete;
+
+    /// Opens existing file or creates an empty one, file that wasn't closed is rejected
+    bool open(const std::string &path);
+    void close();
+
+    /// Writes dirty pages to disk
+    void flush() const {
+        if (base_)
+            msync(base_, mapped_size_, MS_SYNC);
+    }
+
+    bool is_open() const { return base_ != nullptr; }
+
+    NodeT *root() const { return header().root ? reinterpret_cast<NodeT *>(base_ + header().root) : NodeT::nil(); }
+    void set_root(const NodeT *root) { header().root = root->is_nil() ? 0 : offset_of(root); }
+
+    std::size_t page_count() const { return is_open() ? header().page_count : 0; }
+
+    /// Index of the page holding node, pages are counted from 1
+    std::size_t page_of(const NodeT *node) const { return offset_of(node) / page_size; }
+
+    /// New node of a parent is placed near it
+    template <typename... Args>
+    NodeT *create(std::in_place_t tag, NodeT *parent, Args&&... args) {
+        return new (allocate(parent)) NodeT(tag, parent, std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    NodeT *create(Args&&... args) {
+        return new (allocate(NodeT::nil())) NodeT(std::forward<Args>(args)...);
+    }
+
+    /// Moves nodes of the tree into pages by subtrees, returns the new root
+    NodeT *relayout(NodeT *root);
+
+    /// Forgets all nodes, file keeps its size
+    void release() {
+        if (!base_)
+            return;
+
+        header().page_count = 0;
+        header().last_page  = 0;
+        header().root       = 0;
+    }
+};
+
+template <typename NodeT, typename OffsetT>
+bool MappedPool<NodeT, OffsetT>::grow(std::size_t size) {
+    if (size > max_file_size || ftruncate(fd_, static_cast<off_t>(size)) != 0)
+        return false;
+
+    void *mapping = mmap(base_ + mapped_size_, size - mapped_size_, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_FIXED, fd_, static_cast<off_t>(mapped_size_));
+    if (mapping == MAP_FAILED)
+        return false;
+
+    mapped_size_ = size;
+    return true;
+}
+
+template <typename NodeT, typename OffsetT>
+bool MappedPool<NodeT, OffsetT>::open(const std::string &path) {
+    close();
+
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd_ < 0)
+        return false;
+
+    struct stat file_stat{};
+    void *reserved = MAP_FAILED;
+    if (fstat(fd_, &file_stat) == 0)
+        reserved = mmap(nullptr, max_file_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reserved == MAP_FAILED) {
+        close();
+        return false;
+    }
+    base_ = static_cast<unsigned char *>(reserved);
+
+    std::size_t file_size = static_cast<std::size_t>(file_stat.st_size);
+    if (file_size == 0) {
+        if (!grow(page_size * (1 + initial_pages))) {
+            close();
+            return false;
+        }
+
+        FileHeader &file_header = header();
+        std::memcpy(file_header.magic, file_magic, sizeof(file_magic));
+        file_header.version     = file_version;
+        file_header.key_size    = sizeof(std::declval<NodeT &>().key_);
+        file_header.offset_size = sizeof(OffsetT);
+        file_header.node_size   = sizeof(NodeT);
+        file_header.balance     = NodeT::Balance::tag;
+        file_header.page_size   = page_size;
+        file_header.page_count  = 0;
+        file_header.last_page   = 0;
+        file_header.root        = 0;
+        mark(false);
+        return true;
+    }
+
+    if (file_size < page_size || file_size % page_size != 0 || !grow(file_size)) {
+        close();
+        return false;
+    }
+
+    const FileHeader &file_header = header();
+    bool valid = std::memcmp(file_header.magic, file_magic, sizeof(file_magic)) == 0 &&
+                 file_header.version     == file_version &&
+                 file_header.key_size    == sizeof(std::declval<NodeT &>().key_) &&
+                 file_header.offset_size == sizeof(OffsetT) &&
+                 file_header.node_size   == sizeof(NodeT) &&
+                 file_header.balance     == NodeT::Balance::tag &&
+                 file_header.closed      == 1 &&
+                 file_header.page_size   == page_size &&
+                 page_size * (1 + file_header.page_count) <= file_size &&
+                 file_header.root < page_size * (1 + file_header.page_count);
+    if (!valid) {
+        close();
+        return false;
+    }
+
+    mark(false);
+    return true;
+}
+
+template <typename NodeT, typename OffsetT>
+void MappedPool<NodeT, OffsetT>::close() {
+    if (base_) {
+        flush();
+        if (marked_open_)
+            mark(true);
+        munmap(base_, max_file_size);
+    }
+    if (fd_ >= 0)
+        ::close(fd_);
+
+    base_ = nullptr;
+    mapped_size_ = 0;
+    fd_ = -1;
+}
+
+/*
+    Subtree clustering: node goes to the page of its parent if there is space,
+    otherwise to the most recently opened page, otherwise a new page is opened.
+*/
+template <typename NodeT, typename OffsetT>
+NodeT *MappedPool<NodeT, OffsetT>::allocate(const NodeT *parent) {
+    if (!base_)
+        throw std::bad_alloc();
+
+    if (!parent->is_nil()) {
+        if (NodeT *node = take(page_of(parent) * page_size))
+            return node;
+    }
+    if (header().page_count > 0) {
+        if (NodeT *node = take(header().last_page))
+            return node;
+    }
+
+    std::size_t page_offset = page_size * (1 + header().page_count);
+    if (page_offset + page_size > mapped_size_ && !grow(std::min(2 * mapped_size_, max_file_size)) &&
+                                                  !grow(page_offset + page_size)) {
+        throw std::bad_alloc();
+    }
+
+    header().page_count++;
+    header().last_page = page_offset;
+    page(page_offset).used = 0;
+
+    return take(page_offset);
+}
+
+/*
+    Page is filled with top nodes of a subtree in breadth-first order, so a descent stays
+    in one page for at least log2(page_capacity) levels. Subtrees below a full page start
+    new pages, subtrees that fit into the rest of the current page are packed there whole.
+    Any two consecutive pages hold more than page_capacity nodes.
+
+    Nodes are moved within the file without extra memory for them:
+    1. new offset of every node is computed and kept in its tree_size_
+    2. links are translated to new offsets of their targets
+    3. every node is swapped with the one in its new slot until its slot is filled
+    4. links become relative again and sizes are recomputed: children follow their parents
+       in the new layout, so one backward pass is enough
+*/
+template <typename NodeT, typename OffsetT>
+NodeT *MappedPool<NodeT, OffsetT>::relayout(NodeT *root) {
+    if (root->is_nil())
+        return root;
+
+    const std::size_t old_pages = header().page_count;
+    const std::size_t max_pages = std::max(old_pages, 2 * (root->tree_size_ / page_capacity + 1));
+    if (page_size * (1 + max_pages) > mapped_size_ && !grow(page_size * (1 + max_pages)))
+        return root;
+
+    // used slots of new pages, page index is one more than index in vector
+    std::vector<std::size_t> used;
+    auto place = [&](NodeT *node) { node->tree_size_ = slot_offset(used.size(), used.back()++); };
+
+    std::vector<NodeT *> blocks = {root};
+    std::vector<NodeT *> queue, stack;
+    while (!blocks.empty()) {
+        NodeT *block = blocks.back();
+        blocks.pop_back();
+
+        if (!used.empty() && block->tree_size_ <= page_capacity - used.back()) {
+            stack.push_back(block);
+            while (!stack.empty()) {
+                NodeT *node = stack.back();
+                stack.pop_back();
+                place(node);
+
+                if (!node->right_->is_nil()) stack.push_back(node->right_);
+                if (!node->left_->is_nil())  stack.push_back(node->left_);
+            }
+            continue;
+        }
+
+        used.push_back(0);
+        queue.assign(1, block);
+        std::size_t head = 0;
+        while (head < queue.size() && used.back() < page_capacity) {
+            NodeT *node = queue[head++];
+            place(node);
+
+            if (!node->left_->is_nil())  queue.push_back(node->left_);
+            if (!node->right_->is_nil()) queue.push_back(node->right_);
+        }
+
+        // the leftmost subtree below the page goes next
+        for (std::size_t index = queue.size(); index > head; index--) {
+            blocks.push_back(queue[index - 1]);
+        }
+    }
+
+    const std::size_t root_offset = root->tree_size_;
+
+    for (std::size_t page_index = 1; page_index <= old_pages; page_index++) {
+        for (std::size_t slot = 0; slot < page(page_index * page_size).used; slot++) {
+            NodeT *node = node_at(slot_offset(page_index, slot));
+            for (auto *link: {&node->parent_, &node->left_, &node->right_}) {
+                NodeT *target = *link;
+                link->set_file_offset(target->is_nil() ? 0 : target->tree_size_);
+            }
+        }
+    }
+
+    // slot holds a node that is not moved yet if it is after the current one and was used before
+    auto holds_unmoved = [&](std::size_t offset, std::size_t current) {
+        std::size_t page_index = offset / page_size;
+        return offset > current && page_index <= old_pages &&
+               (offset % page_size - first_node) / sizeof(NodeT) < page(page_index * page_size).used;
+    };
+
+    alignas(NodeT) unsigned char buffer[sizeof(NodeT)];
+    for (std::size_t page_index = 1; page_index <= old_pages; page_index++) {
+        for (std::size_t slot = 0; slot < page(page_index * page_size).used; slot++) {
+            const std::size_t current = slot_offset(page_index, slot);
+            while (node_at(current)->tree_size_ != current) {
+                const std::size_t target = node_at(current)->tree_size_;
+                if (!holds_unmoved(target, current)) {
+                    std::memcpy(base_ + target, base_ + current, sizeof(NodeT));
+                    break;
+                }
+
+                std::memcpy(buffer, base_ + target, sizeof(NodeT));
+                std::memcpy(base_ + target, base_ + current, sizeof(NodeT));
+                std::memcpy(base_ + current, buffer, sizeof(NodeT));
+            }
+        }
+    }
+
+    header().page_count = used.size();
+    header().last_page  = used.size() * page_size;
+    for (std::size_t page_index = used.size(); page_index > 0; page_index--) {
+        page(page_index * page_size).used = used[page_index - 1];
+
+        for (std::size_t slot = used[page_index - 1]; slot > 0; slot--) {
+            NodeT *node = node_at(slot_offset(page_index, slot - 1));
+            for (auto *link: {&node->parent_, &node->left_, &node->right_}) {
+                std::size_t offset = link->file_offset();
+                *link = offset ? node_at(offset) : NodeT::nil();
+            }
+            node->tree_size_ = 1 + node->left_->tree_size_ + node->right_->tree_size_;
+        }
+    }
+
+    return node_at(root_offset);
+}
+
+/*
+    Storage of a Tree in a memory-mapped file: nodes are allocated from MappedPool
+    and linked with offset_link. Tree only keeps the root pointer in memory,
+    it is written to the file header by flush() and close().
+
+    Tree is relaid out by pages every time it doubles (auto compaction of Tree),
+    so only the nodes inserted since then are placed just near their parents.
+*/
+template <typename OffsetT = std::uint32_t>
+struct mapped_storage {
+    static_assert(std::is_unsigned_v<OffsetT>, "Offsets must be unsigned");
+
+    template <typename NodeT>
+    using link = offset_link<NodeT, OffsetT>;
+
+    template <typename NodeT>
+    using pool = MappedPool<NodeT, OffsetT>;
+
+    // nodes stay in the file when the tree is destroyed
+    static constexpr bool persistent = true;
+
+    template <typename TreeT>
+    static bool open(TreeT &tree, const std::string &path) {
+        close(tree);
+        if (!tree.pool_.open(path))
+            return false;
+
+        tree.root_ = tree.pool_.root();
+        tree.set_auto_compact(relayout_interval(tree));
+        return true;
+    }
+
+    template <typename TreeT>
+    static void flush(TreeT &tree) {
+        if (!tree.pool_.is_open())
+            return;
+
+        tree.pool_.set_root(tree.root_);
+        tree.pool_.flush();
+    }
+
+    template <typename TreeT>
+    static void close(TreeT &tree) {
+        flush(tree);
+        tree.pool_.close();
+        tree.root_ = tree.tree_nil_;
+    }
+
+    template <typename TreeT>
+    static bool is_open(const TreeT &tree) { return tree.pool_.is_open(); }
+
+    template <typename TreeT>
+    static std::size_t page_count(const TreeT &tree) { return tree.pool_.page_count(); }
+
+    template <typename TreeT>
+    static std::size_t relayout_interval(const TreeT &tree) {
+        return std::max(tree.size(), decltype(tree.pool_)::page_capacity);
+    }
+
+    /// Nodes are always laid out by pages, layout of Tree doesn't apply
+    template <typename TreeT, typename LayoutT>
+    static void compact(TreeT &tree, LayoutT) {
+        tree.root_ = tree.pool_.relayout(tree.root_);
+        tree.auto_compact_inserts_ = relayout_interval(tree);
+    }
+
+    /// Number of distinct pages on the search path of key
+    template <typename TreeT, typename KeyT>
+    static std::size_t pages_on_path(const TreeT &tree, const KeyT& key) {
+        auto last_visited = tree.tree_nil_;
+        tree.lower_bound_node(key, last_visited);
+
+        std::vector<std::size_t> pages;
+        for (auto node = last_visited; !node->is_nil(); node = node->parent_) {
+            pages.push_back(tree.pool_.page_of(node));
+        }
+        std::sort(pages.begin(), pages.end());
+        return static_cast<std::size_t>(std::unique(pages.begin(), pages.end()) - pages.begin());
+    }
+};
+
+/*
+    Tree for key sets larger than RAM: nodes live in a memory-mapped file (mapped_storage),
+    so the tree survives reopening as is. OffsetT is uint32_t for files up to 2 GB or uint64_t.
+    Everything else comes from Tree: balancing policies, key prefixes, batched queries.
+    File must be opened by a tree of the same type: sizes of key, offset and node and balancing
+    policy are checked. File is marked open until close(), so a file left by a crash
+    (stale root, relayout cut short) is rejected; flush() writes data, but doesn't mark it closed.
+    Insert throws std::bad_alloc if the file can't grow anymore.
+*/
+template <typename T, typename CompT = std::less<T>, typename OffsetT = std::uint32_t,
+          typename PrefixT = no_key_prefix, typename BalanceT = red_black>
+class MappedTree : public Tree<T, CompT, PrefixT, BalanceT, mapped_storage<OffsetT>> {
+    static_assert(std::is_trivially_copyable_v<T>, "Mapped tree supports only trivially copyable keys");
+
+    using StorageT = mapped_storage<OffsetT>;
+
+public:
+    MappedTree() = default;
+    ~MappedTree() { close(); }
+
+    MappedTree(const MappedTree& rhs) = delete;
+    MappedTree &operator=(const MappedTree& rhs) = delete;
+
+    /// Opens existing tree file or creates an empty one
+    bool open(const std::string &path) { return StorageT::open(*this, path); }
+    void close() { StorageT::close(*this); }
+
+    /// Writes root and dirty pages to disk
+    void flush() { StorageT::flush(*this); }
+
+    bool is_open() const { return StorageT::is_open(*this); }
+    std::size_t page_count() const { return StorageT::page_count(*this); }
+
+    /// Pages a lookup of key touches, for measuring clustering of nodes
+    std::size_t pages_on_path(const T& key) const { return StorageT::pages_on_path(*this, key); }
+};
+
+} // namespace RBTree
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <future>
+
+#include "rbtree.hpp"
+
+namespace RBTree {
+
+/*
+    Multithreaded parts of Tree, kept apart so the tree itself needs no threading library.
+    Users of this header link with threads (Threads::Threads in CMake).
+*/
+
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+Tree<T, CompT, PrefixT, BalanceT, StorageT> Tree<T, CompT, PrefixT, BalanceT, StorageT>::clone(unsigned threads) const {
+    Tree copy;
+    if (root_ != tree_nil_)
+        copy.root_ = clone_subtree(root_, copy.pool_.allocate_block(size()), tree_nil_, threads);
+
+    return copy;
+}
+
+/// Left subtree is copied in a new thread, both halves get half of the threads
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+Tree<T, CompT, PrefixT, BalanceT, StorageT>::Node *Tree<T, CompT, PrefixT, BalanceT, StorageT>::clone_subtree(const Node *src, Node *dst, Node *parent,
+                                                    unsigned threads) const {
+    if (threads <= 1 || src->tree_size_ < parallel_clone_threshold)
+        return clone_subtree(src, dst, parent);
+
+    Node *node = new (dst) Node(src->key_, parent, &nil_node_, &nil_node_);
+    node->tree_size_ = src->tree_size_;
+    node->balance_ = src->balance_;
+
+    Node *left_dst  = dst + 1;
+    Node *right_dst = dst + 1 + src->left_->tree_size_;
+
+    auto left = std::async(std::launch::async, [=, this]() {
+        return clone_subtree(src->left_, left_dst, node, threads / 2);
+    });
+    node->right_ = clone_subtree(src->right_, right_dst, node, threads - threads / 2);
+    node->left_  = left.get();
+
+    return node;
+}
+
+} // namespace RBTree
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "rbtree.hpp"
+
+namespace RBTree {
+
+/*
+    Dynamic 2D orthogonal range counting over a set of points (x, y).
+
+    Range tree: outer tree is keyed on (x, y) and every node keeps an order-statistic Tree
+    of (y, x) for all points of its subtree, so points of a subtree with y in [y1, y2] are
+    counted with one Tree::count_range. Query splits [x1, x2] into O(log n) subtrees: O(log^2 n).
+
+    Outer tree is weight-balanced by partial rebuilding: the topmost subtree that became
+    unbalanced after insert is rebuilt perfectly balanced together with its inner trees
+    in O(m log m), which gives amortized O(log^2 n) inserts.
+    Subtrees of at most leaf_size points keep no inner tree and are scanned instead.
+*/
+template <typename X, typename Y>
+class RangeTree2D {
+    static_assert(std::numeric_limits<X>::is_specialized, "Inner trees use numeric_limits of X as bounds");
+
+    using InnerKey  = std::pair<Y, X>;
+    using InnerTree = Tree<InnerKey>;
+
+    static constexpr std::size_t leaf_size = 16;
+
+    /// Subtree is rebuilt when one child is delta times heavier than the other
+    static constexpr std::size_t delta = 3;
+
+    struct Node {
+        X x_;
+        Y y_;
+
+        std::unique_ptr<Node> left_  = nullptr;
+        std::unique_ptr<Node> right_ = nullptr;
+
+        std::size_t size_ = 1;
+
+        // points of subtree ordered by y, only if size_ > leaf_size
+        InnerTree inner_;
+
+        Node(const X& x, const Y& y) : x_(x), y_(y), inner_() {}
+    };
+
+    using Link = std::unique_ptr<Node>;
+
+    Link root_ = nullptr;
+
+    static std::size_t size_of(const Link &node) { return node ? node->size_ : 0; }
+
+    static bool balanced(const Node *node) {
+        std::size_t left = size_of(node->left_) + 1, right = size_of(node->right_) + 1;
+        return left <= delta * right && right <= delta * left;
+    }
+
+    static bool less(const X& x, const Y& y, const Node *node) {
+        return x < node->x_ || (!(node->x_ < x) && y < node->y_);
+    }
+
+    /// Appends points of subtree in (x, y) order
+    static void collect(const Node *node, std::vector<std::pair<X, Y>> &points);
+
+    static void build_inner(Node *node);
+
+    /// Builds perfectly balanced subtree from points sorted by (x, y), by_y gets them sorted by (y, x)
+    static Link build(std::span<const std::pair<X, Y>> points, std::vector<InnerKey> &by_y);
+
+    static void rebuild(Link &link);
+
+    /// Points of subtree with y in [y_lo, y_hi]
+    static std::size_t count_y(const Node *node, const Y& y_lo, const Y& y_hi);
+
+    /*
+        lo_inside / hi_inside: all points of subtree are known to have x >= x_lo / x <= x_hi,
+        only two root-to-leaf paths are visited.
+    */
+    static std::size_t count_subtree(const Node *node, const X& x_lo, const X& x_hi,
+                                     const Y& y_lo, const Y& y_hi, bool lo_inside, bool hi_inside);
+
+public:
+    RangeTree2D() = default;
+
+    /// Inserts point if it is not in the set yet, returns true if point was inserted
+    bool insert(const X& x, const Y& y);
+
+    /// Number of points in [x_lo, x_hi] x [y_lo, y_hi]
+    std::size_t count(const X& x_lo, const X& x_hi, const Y& y_lo, const Y& y_hi) const {
+        if (x_hi < x_lo || y_hi < y_lo)
+            return 0;
+
+        return count_subtree(root_.get(), x_lo, x_hi, y_lo, y_hi, false, false);
+    }
+
+    std::size_t size() const { return size_of(root_); }
+};
+
+template <typename X, typename Y>
+bool RangeTree2D<X, Y>::insert(const X& x, const Y& y) {
+    // links to nodes on the path, each of them gets the new point
+    std::vector<Link *> path;
+    Link *link = &root_;
+
+    while (*link) {
+        Node *node = link->get();
+        if (less(x, y, node)) {
+            path.push_back(link);
+            link = &node->left_;
+        } else if (node->x_ < x || node->y_ < y) {
+            path.push_back(link);
+            link = &node->right_;
+        } else {
+            return false;
+        }
+    }
+
+    *link = std::make_unique<Node>(x, y);
+
+    for (Link *ancestor: path) {
+        Node *node = ancestor->get();
+        node->size_++;
+
+        if (node->size_ == leaf_size + 1)
+            build_inner(node);
+        else if (node->size_ > leaf_size + 1)
+            node->inner_.insert(InnerKey(y, x));
+    }
+
+    for (Link *ancestor: path) {
+        if (!balanced(ancestor->get())) {
+            rebuild(*ancestor);
+            break;
+        }
+    }
+
+    return true;
+}
+
+template <typename X, typename Y>
+void RangeTree2D<X, Y>::collect(const Node *node, std::vector<std::pair<X, Y>> &points) {
+    if (!node)
+        return;
+
+    collect(node->left_.get(), points);
+    points.emplace_back(node->x_, node->y_);
+    collect(node->right_.get(), points);
+}
+
+template <typename X, typename Y>
+void RangeTree2D<X, Y>::build_inner(Node *node) {
+    std::vector<std::pair<X, Y>> points;
+    collect(node, points);
+
+    std::vector<InnerKey> by_y;
+    by_y.reserve(points.size());
+    for (const auto &[x, y]: points) by_y.emplace_back(y, x);
+    std::sort(by_y.begin(), by_y.end());
+
+    node->inner_.assign_sorted(by_y);
+}
+
+template <typename X, typename Y>
+typename RangeTree2D<X, Y>::Link RangeTree2D<X, Y>::build(std::span<const std::pair<X, Y>> points,
+                                                          std::vector<InnerKey> &by_y) {
+    by_y.clear();
+    if (points.empty())
+        return nullptr;
+
+    std::size_t mid = points.size() / 2;
+    Link node = std::make_unique<Node>(points[mid].first, points[mid].second);
+    node->size_ = points.size();
+
+    // children lists are merged like in merge sort
+    std::vector<InnerKey> left_by_y, right_by_y;
+    node->left_  = build(points.first(mid), left_by_y);
+    node->right_ = build(points.subspan(mid + 1), right_by_y);
+
+    by_y.reserve(points.size());
+    std::merge(left_by_y.begin(), left_by_y.end(), right_by_y.begin(), right_by_y.end(), std::back_inserter(by_y));
+
+    InnerKey own(node->y_, node->x_);
+    by_y.insert(std::upper_bound(by_y.begin(), by_y.end(), own), own);
+
+    if (node->size_ > leaf_size)
+        node->inner_.assign_sorted(by_y);
+
+    return node;
+}
+
+template <typename X, typename Y>
+void RangeTree2D<X, Y>::rebuild(Link &link) {
+    std::vector<std::pair<X, Y>> points;
+    points.reserve(link->size_);
+    collect(link.get(), points);
+
+    std::vector<InnerKey> by_y;
+    link = build(points, by_y);
+}
+
+template <typename X, typename Y>
+std::size_t RangeTree2D<X, Y>::count_y(const Node *node, const Y& y_lo, const Y& y_hi) {
+    if (!node)
+        return 0;
+
+    if (node->size_ > leaf_size) {
+        return node->inner_.count_range(InnerKey(y_lo, std::numeric_limits<X>::lowest()),
+                                        InnerKey(y_hi, std::numeric_limits<X>::max()));
+    }
+
+    return (!(node->y_ < y_lo) && !(y_hi < node->y_)) +
+           count_y(node->left_.get(), y_lo, y_hi) + count_y(node->right_.get(), y_lo, y_hi);
+}
+
+template <typename X, typename Y>
+std::size_t RangeTree2D<X, Y>::count_subtree(const Node *node, const X& x_lo, const X& x_hi,
+                                             const Y& y_lo, const Y& y_hi, bool lo_inside, bool hi_inside) {
+    if (!node)
+        return 0;
+
+    if (lo_inside && hi_inside)
+        return count_y(node, y_lo, y_hi);
+
+    // subtrees are ordered by x too: left one has x <= node x, right one has x >= node x
+    if (!lo_inside && node->x_ < x_lo)
+        return count_subtree(node->right_.get(), x_lo, x_hi, y_lo, y_hi, lo_inside, hi_inside);
+    if (!hi_inside && x_hi < node->x_)
+        return count_subtree(node->left_.get(), x_lo, x_hi, y_lo, y_hi, lo_inside, hi_inside);
+
+    return (!(node->y_ < y_lo) && !(y_hi < node->y_)) +
+           count_subtree(node->left_.get(),  x_lo, x_hi, y_lo, y_hi, lo_inside, true) +
+           count_subtree(node->right_.get(), x_lo, x_hi, y_lo, y_hi, true, hi_inside);
+}
+
+} // namespace RBTree
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "rbtree.hpp"
+
+namespace RBTree {
+
+/*
+    Snapshot file layout (all sections are 64-byte aligned, so file can be used via mmap directly):
+
+    | SnapshotHeader | keys: T[count] in sorted order | shape: {depth, policy byte}[count] (optional) |
+
+    Checksum covers everything after the header. Policy byte is BalanceT::save of the node.
+    Without shape section tree is rebuilt perfectly balanced, so is a tree deeper than 255 levels
+    and a shape that breaks invariants of the loading tree policy.
+*/
+struct SnapshotHeader {
+    char          magic[8];
+    std::uint32_t version;
+    std::uint32_t flags;
+    std::uint64_t key_size;
+    std::uint64_t count;
+    std::uint64_t keys_offset;
+    std::uint64_t shape_offset;
+    std::uint64_t checksum;
+    std::uint64_t reserved;
+};
+static_assert(sizeof(SnapshotHeader) == 64);
+
+inline constexpr char          snapshot_magic[8] = {'R', 'B', 'T', 'S', 'N', 'A', 'P', '\0'};
+inline constexpr std::uint32_t snapshot_version  = 1;
+inline constexpr std::uint32_t snapshot_has_shape = 0x1;
+inline constexpr std::size_t   snapshot_alignment = 64;
+
+/// FNV-1a over 8-byte words, tail is processed bytewise
+inline std::uint64_t snapshot_checksum(const unsigned char *data, std::size_t size) {
+    constexpr std::uint64_t prime = 0x100000001b3ULL;
+    std::uint64_t hash = 0xcbf29ce484222325ULL;
+
+    std::size_t pos = 0;
+    for (; pos + sizeof(std::uint64_t) <= size; pos += sizeof(std::uint64_t)) {
+        std::uint64_t word = 0;
+        std::memcpy(&word, data + pos, sizeof(word));
+        hash = (hash ^ word) * prime;
+    }
+    for (; pos < size; pos++) {
+        hash = (hash ^ data[pos]) * prime;
+    }
+
+    return hash;
+}
+
+inline std::size_t snapshot_align(std::size_t offset) {
+    return (offset + snapshot_alignment - 1) / snapshot_alignment * snapshot_alignment;
+}
+
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+bool Tree<T, CompT, PrefixT, BalanceT, StorageT>::save(const std::string &path) const {
+    static_assert(std::is_trivially_copyable_v<T>, "Snapshots support only trivially copyable keys");
+
+    const std::size_t count = size();
+
+    SnapshotHeader header{};
+    std::memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+    header.version      = snapshot_version;
+    header.flags        = snapshot_has_shape;
+    header.key_size     = sizeof(T);
+    header.count        = count;
+    header.keys_offset  = sizeof(SnapshotHeader);
+    header.shape_offset = snapshot_align(header.keys_offset + count * sizeof(T));
+
+    std::vector<unsigned char> buffer(header.shape_offset + 2 * count);
+    unsigned char *keys  = buffer.data() + header.keys_offset;
+    unsigned char *shape = buffer.data() + header.shape_offset;
+
+    // in-order traversal with explicit stack to record depths
+    std::vector<std::pair<const Node *, std::size_t>> stack;
+    const Node *node = root_;
+    std::size_t depth = 0;
+    std::size_t index = 0;
+    bool has_shape = true;
+
+    while (true) {
+        while (node != tree_nil_) {
+            stack.emplace_back(node, depth);
+            node = node->left_;
+            depth++;
+        }
+
+        if (stack.empty())
+            break;
+
+        std::tie(node, depth) = stack.back();
+        stack.pop_back();
+
+        std::memcpy(keys + index * sizeof(T), &node->key_, sizeof(T));
+        has_shape &= (depth <= UINT8_MAX);
+        shape[2 * index]     = static_cast<unsigned char>(depth);
+        shape[2 * index + 1] = BalanceT::save(node);
+        index++;
+
+        node = node->right_;
+        depth++;
+    }
+
+    if (!has_shape) {
+        header.flags = 0;
+        header.shape_offset = 0;
+        buffer.resize(header.keys_offset + count * sizeof(T));
+    }
+
+    header.checksum = snapshot_checksum(buffer.data() + sizeof(SnapshotHeader),
+                                        buffer.size() - sizeof(SnapshotHeader));
+    std::memcpy(buffer.data(), &header, sizeof(header));
+
+    std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.good())
+        return false;
+
+    file.write(reinterpret_cast<const char *>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+    return file.good();
+}
+
+template <typename T, typename CompT, typename PrefixT, typename BalanceT, typename StorageT>
+bool Tree<T, CompT, PrefixT, BalanceT, StorageT>::load(const std::string &path) {
+    static_assert(std::is_trivially_copyable_v<T>, "Snapshots support only trivially copyable keys");
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat file_stat{};
+    if (fstat(fd, &file_stat) != 0 || static_cast<std::size_t>(file_stat.st_size) < sizeof(SnapshotHeader)) {
+        close(fd);
+        return false;
+    }
+
+    const std::size_t file_size = static_cast<std::size_t>(file_stat.st_size);
+    void *mapping = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    madvise(mapping, file_size, MADV_SEQUENTIAL);
+
+    const unsigned char *data = static_cast<const unsigned char *>(mapping);
+    SnapshotHeader header{};
+    std::memcpy(&header, data, sizeof(header));
+
+    bool has_shape = header.flags & snapshot_has_shape;
+    bool valid = std::memcmp(header.magic, snapshot_magic, sizeof(header.magic)) == 0 &&
+                 header.version == snapshot_version &&
+                 header.key_size == sizeof(T) &&
+                 header.keys_offset % alignof(T) == 0 &&
+                 header.keys_offset >= sizeof(SnapshotHeader) &&
+                 header.keys_offset <= file_size &&
+                 header.count <= (file_size - header.keys_offset) / sizeof(T) &&
+                 (!has_shape || (header.shape_offset >= header.keys_offset + header.count * sizeof(T) &&
+                                 header.shape_offset <= file_size &&
+                                 header.count <= (file_size - header.shape_offset) / 2)) &&
+                 header.checksum == snapshot_checksum(data + sizeof(SnapshotHeader),
+                                                      file_size - sizeof(SnapshotHeader));
+
+    if (valid) {
+        clear();
+
+        const std::size_t count = header.count;
+        const T *keys = reinterpret_cast<const T *>(data + header.keys_offset);
+
+        if (has_shape) {
+            root_ = build_from_shape(keys, data + header.shape_offset, count);
+            if (!validate())
+                clear();
+        }
+        if (root_ == tree_nil_)
+            assign_sorted(std::span<const T>(keys, count));
+    }
+
+    munmap(mapping, file_size);
+    return valid;
+}
+
+} // namespace RBTree
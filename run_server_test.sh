@@ -0,0 +1,45 @@
+#!/bin/bash
+
+# Script for running end-to-end tests through rbtree_server
+# Usage: ./run_server_test.sh server_program client_program test.dat
+
+if [ $# -ne 3 ]; then
+    echo "Error: Required 3 arguments" >&2
+    echo "Usage: $0 server_program client_program test.dat" >&2
+    exit 1
+fi
+
+SERVER="$1"
+CLIENT="$2"
+TEST="$3"
+
+for program in "$SERVER" "$CLIENT"; do
+    if [ ! -f "$program" ]; then
+        echo "Error: Program '$program' not found" >&2
+        exit 1
+    fi
+done
+
+test_ans_file="${TEST%.*}.ans"
+test_log_file="$(mktemp)"
+socket="$(mktemp -u /tmp/rbtree_test_XXXXXX.sock)"
+
+"$SERVER" --socket "$socket" &
+server_pid=$!
+trap 'kill $server_pid 2>/dev/null; wait $server_pid 2>/dev/null; rm -f "$test_log_file"' EXIT
+
+for _ in $(seq 100); do
+    [ -S "$socket" ] && break
+    sleep 0.02
+done
+
+"$CLIENT" --socket "$socket" --replay < "$TEST" > "$test_log_file"
+
+if diff -q "$test_log_file" "$test_ans_file" > /dev/null; then
+    echo "PASS: $TEST"
+    exit 0
+fi
+
+echo "FAIL: $TEST (differences found)"
+diff -u "$test_ans_file" "$test_log_file"
+exit 1
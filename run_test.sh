@@ -1,23 +1,27 @@
 #!/bin/bash
 
 # Script for running tests
-# Usage: ./run_test.sh test_program test.dat
+# Usage: ./run_test.sh test_program test.dat [program arguments...]
 
-if [ $# -ne 2 ]; then
+if [ $# -lt 2 ]; then
     echo "Error: Required 2 arguments" >&2
-    echo "Usage: $0 test_program test.dat" >&2
+    echo "Usage: $0 test_program test.dat [program arguments...]" >&2
     exit 1
 fi
 
 TESTER="$1"
 TEST="$2"
+shift 2
+ARGS=("$@")
 
 if [ ! -f "$TESTER" ]; then
     echo "Error: Test program '$TESTER' not found" >&2
     exit 1
 fi
 
-test_log_file="${TEST%.*}.log"
+# runs with different arguments may go in parallel, so they write different logs
+args_suffix=$(printf '%s' "${ARGS[*]}" | tr -c 'A-Za-z0-9' '_')
+test_log_file="${TEST%.*}${args_suffix:+_$args_suffix}.log"
 test_ans_file="${TEST%.*}.ans"
 
 if [ ! -f "$TEST" ]; then
@@ -31,7 +35,7 @@ if [ ! -f "$test_ans_file" ]; then
     exit 0
 fi
 
-"$TESTER" < "$TEST" > "$test_log_file"
+"$TESTER" "${ARGS[@]}" < "$TEST" > "$test_log_file"
 
 if diff -q "$test_log_file" "$test_ans_file" > /dev/null; then
     echo "PASS: $TEST"
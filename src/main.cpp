@@ -1,8 +1,14 @@
+#include <charconv>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 
 #include "rbtree.hpp"
+#include "rbtree_buffered.hpp"
+#include "rbtree_cache.hpp"
 #include "rbtree_debug.hpp"
+#include "rbtree_range2d.hpp"
+#include "rbtree_snapshot.hpp"
 
 void check_cin(const std::string err_msg);
 
@@ -14,17 +20,57 @@ void check_cin(const std::string err_msg) {
     return;
 }
 
+void read_size_arg(const std::string &name, const char *value, std::size_t &size);
+
+void read_size_arg(const std::string &name, const char *value, std::size_t &size) {
+    const char *end = value + std::strlen(value);
+    auto [ptr, ec] = std::from_chars(value, end, size);
+    if (ec != std::errc() || ptr != end) {
+        std::cerr << "Invalid value of " << name << ": " << value << "\n";
+        exit(EXIT_FAILURE);
+    }
+}
+
 int main(int argc, const char *argv[]) {
     bool verbose = false;
+    std::string load_snapshot = "";
+    std::string save_snapshot = "";
+    std::size_t buffer_size = 0;
+    std::size_t cache_size = 0;
 
     for (int arg_index = 1; arg_index < argc; arg_index++) {
         std::string arg(argv[arg_index]);
 
         if (arg == "-v")
             verbose = true;
+        else if (arg == "--load-snapshot" && arg_index + 1 < argc)
+            load_snapshot = argv[++arg_index];
+        else if (arg == "--save-snapshot" && arg_index + 1 < argc)
+            save_snapshot = argv[++arg_index];
+        else if (arg == "--buffer" && arg_index + 1 < argc)
+            read_size_arg(arg, argv[++arg_index], buffer_size);
+        else if (arg == "--cache" && arg_index + 1 < argc)
+            read_size_arg(arg, argv[++arg_index], cache_size);
+    }
+
+    if (buffer_size && cache_size) {
+        std::cerr << "--buffer and --cache can't be used together\n";
+        exit(EXIT_FAILURE);
     }
 
     RBTree::Tree<int> tree;
+    RBTree::RangeTree2D<int, int> points;
+
+    // with --buffer inserts go through write buffer
+    RBTree::BufferedTree<int> buffered(tree, buffer_size);
+
+    // with --cache range counts are memoized, inserts update cached counts
+    RBTree::RangeCountCache<int> cache(tree, cache_size);
+
+    if (!load_snapshot.empty() && !tree.load(load_snapshot)) {
+        std::cerr << "Failed to load snapshot " << load_snapshot << "\n";
+        exit(EXIT_FAILURE);
+    }
 
     std::string input = "";
     while (std::cin >> input) {
@@ -34,7 +80,9 @@ int main(int argc, const char *argv[]) {
             int key = 0;
             std::cin >> key;
             check_cin("Failed to read key\n");
-            tree.insert(key);
+            if (buffer_size)     buffered.insert(key);
+            else if (cache_size) cache.insert(key);
+            else                 tree.insert(key);
 
             if (verbose) std::cout << "Add key " << key << "\n";
         }
@@ -49,16 +97,41 @@ int main(int argc, const char *argv[]) {
             if (verbose) std::cout << "Range query " << fst << " " << snd << "\n";
 
             int distance = 0;
-            if (snd > fst) distance = tree.distance(tree.lower_bound(fst), tree.upper_bound(snd));
+            if (snd > fst && buffer_size)     distance = static_cast<int>(buffered.count_range(fst, snd));
+            else if (snd > fst && cache_size) distance = static_cast<int>(cache.count_range(fst, snd));
+            else if (snd > fst)               distance = tree.distance(tree.lower_bound(fst), tree.upper_bound(snd));
 
             std::cout << distance << " ";
         }
+        else if (input == "p") {
+            int x = 0, y = 0;
+            std::cin >> x >> y;
+            check_cin("Failed to read point\n");
+            points.insert(x, y);
+
+            if (verbose) std::cout << "Add point " << x << " " << y << "\n";
+        }
+        else if (input == "r") {
+            int x_lo = 0, x_hi = 0, y_lo = 0, y_hi = 0;
+            std::cin >> x_lo >> x_hi >> y_lo >> y_hi;
+            check_cin("Failed to read rectangle\n");
+
+            if (verbose) std::cout << "Rectangle query " << x_lo << " " << x_hi << " " << y_lo << " " << y_hi << "\n";
+
+            std::cout << points.count(x_lo, x_hi, y_lo, y_hi) << " ";
+        }
         else {
             std::cerr << "Unexpected keyword:" << input << "\n";
             exit(EXIT_FAILURE);
         }
     }
     std::cout << "\n";
+    buffered.flush();
+
+    if (!save_snapshot.empty() && !tree.save(save_snapshot)) {
+        std::cerr << "Failed to save snapshot " << save_snapshot << "\n";
+        exit(EXIT_FAILURE);
+    }
 
     if (verbose) {
         tree.print_debug(std::cout, tree.get_root());
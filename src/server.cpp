@@ -0,0 +1,388 @@
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "rbtree.hpp"
+
+/*
+    Server keeps named trees in memory and serves requests over a unix domain socket.
+
+    Request is one line of commands in rbtree format: "k <int>", "q <int> <int>"
+    and "t <name>" that selects a tree for the rest of the connection (initially "default").
+    Response is one line with answers to all queries of the request in rbtree output format.
+    Request is parsed completely before it is executed: a malformed one is not applied at all
+    and gets "error: command <index>: <reason>" (commands are counted from 1) as response.
+    Clients may pipeline requests: responses come in the same order.
+
+    Connection is not read while max_pending_output bytes of responses wait for the client,
+    request lines longer than max_line_length are answered with an error and the connection is closed.
+    When descriptors run out, new connections wait until one is closed or accept_retry_ms passes.
+*/
+
+using TreeMap = std::unordered_map<std::string, RBTree::Tree<int>>;
+
+// replayed test files are sent as single requests of about 1 MiB
+static constexpr std::size_t max_line_length    = 16 << 20;
+static constexpr std::size_t max_pending_output = 1 << 20;
+
+// accept is retried after this time or when a connection is closed
+static constexpr int accept_retry_ms = 1000;
+
+struct Connection {
+    std::string input  = "";
+    std::string output = "";
+
+    // input before scanned has no line breaks, so each received byte is searched once
+    std::size_t scanned = 0;
+
+    std::size_t output_pos = 0;
+
+    // no more requests are read (client closed its write side or sent too long line),
+    // connection lives until responses are sent
+    bool closing = false;
+
+    RBTree::Tree<int> *tree = nullptr;
+
+    bool output_full() const { return output.size() - output_pos >= max_pending_output; }
+};
+
+struct Command {
+    char type = 'k';
+    int fst = 0, snd = 0;
+    std::string_view name{};
+};
+
+static volatile std::sig_atomic_t stop_requested = 0;
+
+static void request_stop(int) {
+    stop_requested = 1;
+}
+
+static bool next_token(std::string_view &line, std::string_view &token) {
+    std::size_t begin = line.find_first_not_of(" \t\r");
+    if (begin == std::string_view::npos)
+        return false;
+
+    std::size_t end = line.find_first_of(" \t\r", begin);
+    if (end == std::string_view::npos)
+        end = line.size();
+
+    token = line.substr(begin, end - begin);
+    line.remove_prefix(end);
+    return true;
+}
+
+static bool next_int(std::string_view &line, int &value) {
+    std::string_view token;
+    if (!next_token(line, token))
+        return false;
+
+    auto [ptr, ec] = std::from_chars(token.data(), token.data() + token.size(), value);
+    return ec == std::errc() && ptr == token.data() + token.size();
+}
+
+/// Parses the whole line, returns error message or empty string
+static std::string parse_request(std::string_view line, std::vector<Command> &commands) {
+    commands.clear();
+
+    std::string_view token;
+    while (next_token(line, token)) {
+        std::string error_prefix = "error: command " + std::to_string(commands.size() + 1) + ": ";
+        Command command;
+
+        if (token == "k") {
+            command.type = 'k';
+            if (!next_int(line, command.fst))
+                return error_prefix + "failed to read key";
+        }
+        else if (token == "q") {
+            command.type = 'q';
+            if (!next_int(line, command.fst) || !next_int(line, command.snd))
+                return error_prefix + "failed to read query bounds";
+        }
+        else if (token == "t") {
+            command.type = 't';
+            if (!next_token(line, command.name))
+                return error_prefix + "failed to read tree name";
+        }
+        else {
+            return error_prefix + "unexpected keyword " + std::string(token);
+        }
+
+        commands.push_back(command);
+    }
+
+    return "";
+}
+
+/// Executes one request line, malformed request is not applied and gets error as response
+static void process_request(std::string_view line, Connection &conn, TreeMap &trees) {
+    thread_local std::vector<Command> commands;
+
+    std::string error = parse_request(line, commands);
+    if (!error.empty()) {
+        conn.output += error;
+        conn.output += '\n';
+        return;
+    }
+
+    std::string response = "";
+    for (const Command &command: commands) {
+        switch (command.type) {
+        case 'k':
+            conn.tree->insert(command.fst);
+            break;
+        case 'q': {
+            std::size_t distance = 0;
+            if (command.snd > command.fst)
+                distance = conn.tree->distance(conn.tree->lower_bound(command.fst), conn.tree->upper_bound(command.snd));
+
+            response += std::to_string(distance);
+            response += ' ';
+            break;
+        }
+        case 't': default:
+            conn.tree = &trees[std::string(command.name)];
+            break;
+        }
+    }
+
+    conn.output += response;
+    conn.output += '\n';
+}
+
+/// Returns false on read error, stops reading while responses are not taken by the client
+static bool read_requests(int fd, Connection &conn, TreeMap &trees) {
+    char buffer[1 << 16];
+
+    while (!conn.closing && !conn.output_full()) {
+        ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+        if (received == 0) {
+            // last request may come without line break
+            if (!conn.input.empty())
+                process_request(conn.input, conn, trees);
+
+            conn.input.clear();
+            conn.closing = true;
+            return true;
+        }
+        if (received < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN;
+        }
+
+        conn.input.append(buffer, static_cast<std::size_t>(received));
+
+        // process all complete lines, incomplete tail waits for more data
+        std::size_t begin = 0, end = 0;
+        while ((end = conn.input.find('\n', std::max(begin, conn.scanned))) != std::string::npos &&
+               end - begin <= max_line_length) {
+            process_request(std::string_view(conn.input).substr(begin, end - begin), conn, trees);
+            begin = end + 1;
+        }
+
+        // the rest of a too long line can't be told from the next request, so connection is closed
+        if ((end == std::string::npos ? conn.input.size() : end) - begin > max_line_length) {
+            conn.output += "error: request line is longer than " + std::to_string(max_line_length) + " bytes\n";
+            conn.input.clear();
+            conn.scanned = 0;
+            conn.closing = true;
+        } else {
+            conn.input.erase(0, begin);
+            conn.scanned = conn.input.size();
+        }
+    }
+
+    return true;
+}
+
+/// Returns false on write error
+static bool write_responses(int fd, Connection &conn) {
+    while (conn.output_pos < conn.output.size()) {
+        ssize_t sent = send(fd, conn.output.data() + conn.output_pos, conn.output.size() - conn.output_pos, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN;
+        }
+        conn.output_pos += static_cast<std::size_t>(sent);
+    }
+
+    conn.output.clear();
+    conn.output_pos = 0;
+    return true;
+}
+
+static void update_events(int epoll_fd, int fd, const Connection &conn) {
+    epoll_event event{};
+    event.data.fd = fd;
+    event.events = ((conn.closing || conn.output_full()) ? 0u : EPOLLIN) |
+                   ((conn.output_pos < conn.output.size()) ? EPOLLOUT : 0u);
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+}
+
+/// Listening socket is not watched while connections can't be accepted
+static void watch_listener(int epoll_fd, int listen_fd, bool watch) {
+    epoll_event event{};
+    event.data.fd = listen_fd;
+    event.events = watch ? EPOLLIN : 0u;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, listen_fd, &event);
+}
+
+static int open_socket(const std::string &path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    // socket appears under its name only when it already accepts connections
+    std::string tmp_path = path + ".tmp";
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (tmp_path.size() >= sizeof(addr.sun_path)) {
+        close(fd);
+        return -1;
+    }
+    std::memcpy(addr.sun_path, tmp_path.c_str(), tmp_path.size() + 1);
+
+    unlink(tmp_path.c_str());
+    if (bind(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        listen(fd, SOMAXCONN) != 0 ||
+        rename(tmp_path.c_str(), path.c_str()) != 0) {
+        unlink(tmp_path.c_str());
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int main(int argc, const char *argv[]) {
+    std::string socket_path = "/tmp/rbtree.sock";
+
+    for (int arg_index = 1; arg_index < argc; arg_index++) {
+        std::string arg(argv[arg_index]);
+
+        if (arg == "--socket" && arg_index + 1 < argc)
+            socket_path = argv[++arg_index];
+    }
+
+    int listen_fd = open_socket(socket_path);
+    if (listen_fd < 0) {
+        std::cerr << "Failed to listen on " << socket_path << ": " << std::strerror(errno) << "\n";
+        exit(EXIT_FAILURE);
+    }
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event listen_event{};
+    listen_event.data.fd = listen_fd;
+    listen_event.events = EPOLLIN;
+    if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &listen_event) != 0) {
+        std::cerr << "Failed to set up epoll: " << std::strerror(errno) << "\n";
+        exit(EXIT_FAILURE);
+    }
+
+    std::signal(SIGINT,  request_stop);
+    std::signal(SIGTERM, request_stop);
+
+    TreeMap trees;
+    std::unordered_map<int, Connection> connections;
+
+    constexpr int max_events = 64;
+    epoll_event events[max_events];
+
+    // accept is paused when process or system is out of descriptors: pending connection
+    // keeps listening socket readable, so retrying at once would spin
+    bool accept_paused = false;
+
+    while (!stop_requested) {
+        int ready = epoll_wait(epoll_fd, events, max_events, accept_paused ? accept_retry_ms : -1);
+        if (ready < 0) {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "epoll_wait failed: " << std::strerror(errno) << "\n";
+            break;
+        }
+
+        if (ready == 0 && accept_paused) {
+            watch_listener(epoll_fd, listen_fd, true);
+            accept_paused = false;
+        }
+
+        for (int event_index = 0; event_index < ready; event_index++) {
+            int fd = events[event_index].data.fd;
+
+            if (fd == listen_fd) {
+                int client_fd = -1;
+                while ((client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    epoll_event event{};
+                    event.data.fd = client_fd;
+                    event.events = EPOLLIN;
+                    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &event) != 0) {
+                        std::cerr << "Failed to watch connection: " << std::strerror(errno) << "\n";
+                        close(client_fd);
+                        continue;
+                    }
+
+                    connections[client_fd].tree = &trees["default"];
+                }
+
+                if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                    std::cerr << "Failed to accept connection: " << std::strerror(errno) << "\n";
+                    watch_listener(epoll_fd, listen_fd, false);
+                    accept_paused = true;
+                }
+                continue;
+            }
+
+            Connection &conn = connections[fd];
+            bool alive = true;
+
+            if (!conn.closing && (events[event_index].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+                alive = read_requests(fd, conn, trees);
+
+            if (alive && !conn.output.empty())
+                alive = write_responses(fd, conn);
+
+            // remaining responses are still sent if client closed only its write side
+            if (conn.closing && conn.output.empty())
+                alive = false;
+
+            if (alive) {
+                update_events(epoll_fd, fd, conn);
+            } else {
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+                close(fd);
+                connections.erase(fd);
+
+                if (accept_paused) {
+                    watch_listener(epoll_fd, listen_fd, true);
+                    accept_paused = false;
+                }
+            }
+        }
+    }
+
+    for (auto &[fd, conn]: connections) {
+        close(fd);
+    }
+    close(epoll_fd);
+    close(listen_fd);
+    unlink(socket_path.c_str());
+
+    return 0;
+}
@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+    Load generator for rbtree_server.
+
+    Every client sends requests of --commands random commands ("k" or "q" with --query-ratio
+    percent of queries) keeping up to --pipeline requests in flight, and measures latency
+    from sending a request to receiving its response line.
+
+    With --replay whole stdin is sent as one request and the response is printed,
+    so output matches output of rbtree for the same input.
+*/
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string socket_path = "/tmp/rbtree.sock";
+    unsigned clients   = 4;
+    unsigned requests  = 10000;
+    unsigned pipeline  = 1;
+    unsigned commands  = 8;
+    unsigned query_ratio = 50;
+    int max_key = 1000000;
+    bool replay = false;
+};
+
+static int connect_socket(const std::string &path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        close(fd);
+        return -1;
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    if (connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static bool send_all(int fd, const std::string &data) {
+    std::size_t pos = 0;
+    while (pos < data.size()) {
+        ssize_t sent = send(fd, data.data() + pos, data.size() - pos, MSG_NOSIGNAL);
+        if (sent <= 0)
+            return false;
+        pos += static_cast<std::size_t>(sent);
+    }
+    return true;
+}
+
+/// Reads responses until at least one full line is in buffer, returns number of lines
+static std::size_t receive_lines(int fd, std::string &buffer) {
+    char chunk[1 << 16];
+
+    while (true) {
+        std::size_t lines = static_cast<std::size_t>(std::count(buffer.begin(), buffer.end(), '\n'));
+        if (lines > 0)
+            return lines;
+
+        ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+        if (received <= 0)
+            return 0;
+        buffer.append(chunk, static_cast<std::size_t>(received));
+    }
+}
+
+static int replay(const Options &options) {
+    int fd = connect_socket(options.socket_path);
+    if (fd < 0) {
+        std::cerr << "Failed to connect to " << options.socket_path << "\n";
+        return EXIT_FAILURE;
+    }
+
+    std::string request(std::istreambuf_iterator<char>(std::cin), {});
+    std::replace(request.begin(), request.end(), '\n', ' ');
+    request += '\n';
+
+    std::string response = "";
+    if (!send_all(fd, request) || receive_lines(fd, response) == 0) {
+        std::cerr << "Server closed connection\n";
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    std::cout << response.substr(0, response.find('\n') + 1);
+    close(fd);
+    return 0;
+}
+
+/// Runs one client, returns latencies of its requests in nanoseconds
+static std::vector<double> run_client(const Options &options, unsigned client_index) {
+    std::vector<double> latencies;
+    latencies.reserve(options.requests);
+
+    int fd = connect_socket(options.socket_path);
+    if (fd < 0) {
+        std::cerr << "Failed to connect to " << options.socket_path << "\n";
+        return latencies;
+    }
+
+    std::mt19937 gen(client_index);
+    std::uniform_int_distribution<int> key_dist(0, options.max_key);
+    std::uniform_int_distribution<unsigned> type_dist(0, 99);
+
+    auto make_request = [&]() {
+        std::string request = "";
+        for (unsigned command = 0; command < options.commands; command++) {
+            if (type_dist(gen) < options.query_ratio) {
+                int fst = key_dist(gen);
+                request += "q " + std::to_string(fst) + " " + std::to_string(fst + key_dist(gen) / 100) + " ";
+            } else {
+                request += "k " + std::to_string(key_dist(gen)) + " ";
+            }
+        }
+        request.back() = '\n';
+        return request;
+    };
+
+    std::deque<Clock::time_point> in_flight;
+    std::string buffer = "";
+    unsigned sent = 0;
+
+    while (latencies.size() < options.requests) {
+        // fill pipeline with new requests
+        std::string batch = "";
+        while (sent < options.requests && in_flight.size() < options.pipeline) {
+            batch += make_request();
+            in_flight.push_back(Clock::now());
+            sent++;
+        }
+        if (!batch.empty() && !send_all(fd, batch))
+            break;
+
+        std::size_t lines = receive_lines(fd, buffer);
+        if (lines == 0)
+            break;
+
+        Clock::time_point now = Clock::now();
+        for (std::size_t line = 0; line < lines; line++) {
+            latencies.push_back(std::chrono::duration<double, std::nano>(now - in_flight.front()).count());
+            in_flight.pop_front();
+        }
+        buffer.erase(0, buffer.rfind('\n') + 1);
+    }
+
+    close(fd);
+    return latencies;
+}
+
+int main(int argc, const char *argv[]) {
+    Options options;
+
+    for (int arg_index = 1; arg_index < argc; arg_index++) {
+        std::string arg(argv[arg_index]);
+        bool has_value = arg_index + 1 < argc;
+
+        if (arg == "--replay")
+            options.replay = true;
+        else if (arg == "--socket" && has_value)
+            options.socket_path = argv[++arg_index];
+        else if (arg == "--clients" && has_value)
+            options.clients = static_cast<unsigned>(std::stoul(argv[++arg_index]));
+        else if (arg == "--requests" && has_value)
+            options.requests = static_cast<unsigned>(std::stoul(argv[++arg_index]));
+        else if (arg == "--pipeline" && has_value)
+            options.pipeline = std::max(1u, static_cast<unsigned>(std::stoul(argv[++arg_index])));
+        else if (arg == "--commands" && has_value)
+            options.commands = std::max(1u, static_cast<unsigned>(std::stoul(argv[++arg_index])));
+        else if (arg == "--query-ratio" && has_value)
+            options.query_ratio = static_cast<unsigned>(std::stoul(argv[++arg_index]));
+        else if (arg == "--max-key" && has_value)
+            options.max_key = std::stoi(argv[++arg_index]);
+        else {
+            std::cerr << "Unexpected argument: " << arg << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (options.replay)
+        return replay(options);
+
+    std::vector<std::vector<double>> results(options.clients);
+    std::vector<std::thread> threads;
+
+    Clock::time_point start = Clock::now();
+    for (unsigned client = 0; client < options.clients; client++) {
+        threads.emplace_back([&, client]() { results[client] = run_client(options, client); });
+    }
+    for (std::thread &thread: threads) {
+        thread.join();
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::vector<double> latencies;
+    for (auto &result: results) {
+        latencies.insert(latencies.end(), result.begin(), result.end());
+    }
+    if (latencies.empty()) {
+        std::cerr << "No requests completed\n";
+        return EXIT_FAILURE;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    auto percentile = [&](double fraction) {
+        std::size_t index = static_cast<std::size_t>(fraction * static_cast<double>(latencies.size() - 1));
+        return latencies[index] / 1000;
+    };
+
+    double requests = static_cast<double>(latencies.size());
+    std::cout << "clients "  << options.clients << ", pipeline " << options.pipeline
+              << ", commands per request " << options.commands << "\n"
+              << "requests   " << latencies.size() << " in " << elapsed << " s\n"
+              << "throughput " << requests / elapsed << " req/s, "
+                               << requests * options.commands / elapsed << " commands/s\n"
+              << "latency us p50 " << percentile(0.5) << ", p90 " << percentile(0.9)
+              << ", p99 " << percentile(0.99) << ", p99.9 " << percentile(0.999)
+              << ", max " << latencies.back() / 1000 << "\n";
+
+    return 0;
+}
@@ -1,12 +1,26 @@
 #include <benchmark/benchmark.h>
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <fstream>
+#include <limits>
+#include <map>
+#include <random>
 #include <regex>
 #include <string>
+#include <linux/perf_event.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #include <utility>
 #include "rbtree.hpp"
+#include "rbtree_buffered.hpp"
+#include "rbtree_cache.hpp"
+#include "rbtree_parallel.hpp"
+#include "rbtree_snapshot.hpp"
+#include "rbtree_mapped.hpp"
+#include "rbtree_range2d.hpp"
 
 enum QueryType {
     KEY = 0,
@@ -94,6 +108,465 @@ static void BM_Tree_impl(benchmark::State& state, std::string filename) {
     }
 }
 
+static std::vector<int> random_keys(std::size_t count) {
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> dist;
+
+    std::vector<int> keys(count);
+    for (int& key: keys) key = dist(gen);
+
+    return keys;
+}
+
+/// Rebuild tree by replaying every insert from the command log
+static void BM_Rebuild_Insert(benchmark::State& state) {
+    std::vector<int> keys = random_keys(static_cast<std::size_t>(state.range(0)));
+    for (auto _ : state) {
+        RBTree::Tree<int> tree;
+        for (int key: keys) tree.insert(key);
+        benchmark::DoNotOptimize(tree.size());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+/// Rebuild tree from snapshot file
+static void BM_Snapshot_Reload(benchmark::State& state) {
+    const std::string path = "bench_snapshot_" + std::to_string(state.range(0)) + ".bin";
+    {
+        RBTree::Tree<int> tree;
+        for (int key: random_keys(static_cast<std::size_t>(state.range(0)))) tree.insert(key);
+        tree.save(path);
+    }
+
+    for (auto _ : state) {
+        RBTree::Tree<int> tree;
+        if (!tree.load(path)) {
+            state.SkipWithError("Failed to load snapshot");
+            break;
+        }
+        benchmark::DoNotOptimize(tree.size());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+
+    std::remove(path.c_str());
+}
+
+/// Copy tree structure, second argument is number of threads
+static void BM_Clone(benchmark::State& state) {
+    RBTree::Tree<int> tree;
+    for (int key: random_keys(static_cast<std::size_t>(state.range(0)))) tree.insert(key);
+
+    for (auto _ : state) {
+        RBTree::Tree<int> copy = tree.clone(static_cast<unsigned>(state.range(1)));
+        benchmark::DoNotOptimize(copy.size());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+/// Trees of random keys are expensive to build, so they are shared between benchmarks
+static const RBTree::Tree<int>& cached_random_tree(std::size_t count) {
+    static std::map<std::size_t, RBTree::Tree<int>> trees;
+
+    auto [it, inserted] = trees.try_emplace(count);
+    if (inserted) {
+        for (int key: random_keys(count)) it->second.insert(key);
+    }
+
+    return it->second;
+}
+
+static constexpr std::size_t query_count = 1 << 16;
+
+/// Range counts one by one, second argument selects batched version
+static void BM_Count_Range(benchmark::State& state) {
+    const RBTree::Tree<int>& tree = cached_random_tree(static_cast<std::size_t>(state.range(0)));
+    std::vector<int> lo = random_keys(query_count), hi(query_count);
+    for (std::size_t index = 0; index < query_count; index++) hi[index] = lo[index] / 2 + (1 << 30);
+
+    std::vector<std::size_t> result(query_count);
+    for (auto _ : state) {
+        if (state.range(1)) {
+            tree.count_range_batch(lo, hi, result);
+        } else {
+            for (std::size_t index = 0; index < query_count; index++)
+                result[index] = tree.count_range(lo[index], hi[index]);
+        }
+        benchmark::DoNotOptimize(result.data());
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(query_count));
+}
+
+/// Lower bounds one by one, second argument selects batched version
+static void BM_Lower_Bound(benchmark::State& state) {
+    const RBTree::Tree<int>& tree = cached_random_tree(static_cast<std::size_t>(state.range(0)));
+    std::vector<int> keys = random_keys(query_count);
+
+    std::vector<RBTree::Tree<int>::iterator> result(query_count);
+    for (auto _ : state) {
+        if (state.range(1)) {
+            tree.lower_bound_batch(keys, result);
+        } else {
+            for (std::size_t index = 0; index < query_count; index++)
+                result[index] = tree.lower_bound(keys[index]);
+        }
+        benchmark::DoNotOptimize(result.data());
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(query_count));
+}
+
+enum PolicyWorkload {
+    RANDOM_INSERTS = 0,
+    SORTED_INSERTS = 1,
+    UNIFORM_QUERIES = 2,
+    HOT_KEY_QUERIES = 3
+};
+
+/// Same workloads for every balancing policy: first argument is PolicyWorkload, second is number of keys
+template <typename BalanceT>
+static void BM_Policy(benchmark::State& state) {
+    using PolicyTree = RBTree::Tree<int, std::less<int>, RBTree::no_key_prefix, BalanceT>;
+    const auto workload = static_cast<PolicyWorkload>(state.range(0));
+    const std::size_t count = static_cast<std::size_t>(state.range(1));
+
+    std::vector<int> keys = random_keys(count);
+    if (workload == SORTED_INSERTS)
+        std::sort(keys.begin(), keys.end());
+
+    if (workload == RANDOM_INSERTS || workload == SORTED_INSERTS) {
+        std::size_t height = 0;
+        for (auto _ : state) {
+            PolicyTree tree;
+            for (int key: keys) tree.insert(key);
+            height = tree.height();
+            benchmark::DoNotOptimize(tree.size());
+        }
+        state.counters["height"] = static_cast<double>(height);
+        state.SetItemsProcessed(state.iterations() * state.range(1));
+        return;
+    }
+
+    PolicyTree tree;
+    for (int key: keys) tree.insert(key);
+
+    // hot-key queries: 90% of ranges start at one of 64 keys
+    std::vector<int> lo = random_keys(query_count);
+    if (workload == HOT_KEY_QUERIES) {
+        std::mt19937 gen(7);
+        std::uniform_int_distribution<std::size_t> hot(0, 63), percent(0, 99);
+        for (int& key: lo) {
+            if (percent(gen) < 90) key = keys[hot(gen)];
+        }
+    }
+
+    std::size_t total = 0;
+    for (auto _ : state) {
+        for (int key: lo) {
+            // same query as in src/main.cpp, random keys are non-negative
+            int hi = key + std::min(1 << 20, std::numeric_limits<int>::max() - key);
+            total += tree.distance(tree.lower_bound(key), tree.upper_bound(hi));
+        }
+        benchmark::DoNotOptimize(total);
+    }
+    state.counters["height"] = static_cast<double>(tree.height());
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(query_count));
+}
+
+/// (timestamp, value) points with growing timestamps, as in monitoring data
+static std::vector<std::pair<int, int>> timestamped_points(std::size_t count) {
+    std::vector<int> values = random_keys(count);
+    std::vector<std::pair<int, int>> points(count);
+    for (std::size_t index = 0; index < count; index++)
+        points[index] = {static_cast<int>(index), values[index]};
+
+    return points;
+}
+
+static void BM_Range2D_Insert(benchmark::State& state) {
+    auto points = timestamped_points(static_cast<std::size_t>(state.range(0)));
+    for (auto _ : state) {
+        RBTree::RangeTree2D<int, int> tree;
+        for (auto [x, y]: points) tree.insert(x, y);
+        benchmark::DoNotOptimize(tree.size());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_Range2D_Count(benchmark::State& state) {
+    const std::size_t count = static_cast<std::size_t>(state.range(0));
+    RBTree::RangeTree2D<int, int> tree;
+    for (auto [x, y]: timestamped_points(count)) tree.insert(x, y);
+
+    // windows over the last tenth of timestamps with random value bands
+    std::vector<int> keys = random_keys(query_count);
+    const int window = static_cast<int>(count / 10);
+
+    std::size_t total = 0;
+    for (auto _ : state) {
+        for (int key: keys) {
+            int t_lo = key % static_cast<int>(count), v_lo = key / 2;
+            total += tree.count(t_lo, t_lo + window, v_lo, v_lo + (1 << 28));
+        }
+        benchmark::DoNotOptimize(total);
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(query_count));
+}
+
+/*
+    Stream of inserts and range queries with given number of inserts per query.
+    Second argument is buffer capacity (0 - plain tree), third one selects QueryMode::flush.
+*/
+static void BM_Buffered(benchmark::State& state) {
+    using Buffered = RBTree::BufferedTree<int>;
+    const std::size_t inserts_per_query = static_cast<std::size_t>(state.range(0));
+    const std::size_t capacity = static_cast<std::size_t>(state.range(1));
+    const auto mode = state.range(2) ? Buffered::QueryMode::flush : Buffered::QueryMode::merge;
+
+    constexpr std::size_t operation_count = 1 << 20;
+    std::vector<int> keys = random_keys(operation_count);
+
+    std::size_t total = 0;
+    for (auto _ : state) {
+        RBTree::Tree<int> tree;
+        Buffered buffered(tree, capacity, mode);
+
+        for (std::size_t index = 0; index < operation_count; index++) {
+            int key = keys[index];
+            if (index % (inserts_per_query + 1) != inserts_per_query) {
+                if (capacity) buffered.insert(key);
+                else          tree.insert(key);
+                continue;
+            }
+
+            int hi = key + std::min(1 << 24, std::numeric_limits<int>::max() - key);
+            total += capacity ? buffered.count_range(key, hi) : tree.count_range(key, hi);
+        }
+        benchmark::DoNotOptimize(total);
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(operation_count));
+}
+
+/*
+    Lookups in a tree built by random inserts, second argument selects layout:
+    0 - nodes in allocation order, 1 - compacted depth-first, 2 - compacted van Emde Boas.
+*/
+static void BM_Compact(benchmark::State& state) {
+    using Layout = RBTree::Tree<int>::Layout;
+    const RBTree::Tree<int>& random_tree = cached_random_tree(static_cast<std::size_t>(state.range(0)));
+
+    RBTree::Tree<int> compacted;
+    if (state.range(1)) {
+        // clone of the tree is not scattered, so relayout the original one
+        RBTree::Tree<int> tree;
+        for (int key: random_keys(static_cast<std::size_t>(state.range(0)))) tree.insert(key);
+
+        auto start = std::chrono::steady_clock::now();
+        tree.compact(state.range(1) == 1 ? Layout::depth_first : Layout::van_emde_boas);
+        state.counters["compact_ms"] =
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        compacted = std::move(tree);
+    }
+    const RBTree::Tree<int>& tree = state.range(1) ? compacted : random_tree;
+
+    std::vector<int> keys = random_keys(query_count);
+    std::reverse(keys.begin(), keys.end());
+
+    std::vector<RBTree::Tree<int>::iterator> result(query_count);
+    for (auto _ : state) {
+        for (std::size_t index = 0; index < query_count; index++)
+            result[index] = tree.lower_bound(keys[index]);
+        benchmark::DoNotOptimize(result.data());
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(query_count));
+}
+
+/*
+    Dashboard workload: the same distinct ranges are queried over and over in random order,
+    with an insert of a random key every 16 queries. Second argument is cache capacity (0 - plain tree).
+*/
+static void BM_RangeCache(benchmark::State& state) {
+    const std::size_t distinct = static_cast<std::size_t>(state.range(0));
+    const std::size_t capacity = static_cast<std::size_t>(state.range(1));
+    constexpr std::size_t inserts_every = 16;
+
+    RBTree::Tree<int> tree(cached_random_tree(1 << 20));
+    RBTree::RangeCountCache<int> cache(tree, capacity);
+
+    std::vector<int> bounds = random_keys(2 * distinct);
+    std::vector<std::pair<int, int>> ranges;
+    for (std::size_t index = 0; index < distinct; index++)
+        ranges.emplace_back(std::minmax(bounds[2 * index], bounds[2 * index + 1]));
+
+    std::mt19937 gen(7);
+    std::vector<std::size_t> order(query_count);
+    for (std::size_t &range: order) range = gen() % distinct;
+    std::vector<int> new_keys = random_keys(query_count / inserts_every);
+
+    std::size_t total = 0, inserted = 0;
+    for (auto _ : state) {
+        for (std::size_t index = 0; index < query_count; index++) {
+            if (index % inserts_every == 0) {
+                // keys repeat across iterations, only the first insert of a key changes counts
+                int key = new_keys[(inserted++) % new_keys.size()] ^ 1;
+                if (capacity) cache.insert(key);
+                else          tree.insert(key);
+            }
+
+            auto [lo, hi] = ranges[order[index]];
+            total += capacity ? cache.count_range(lo, hi) : tree.count_range(lo, hi);
+        }
+        benchmark::DoNotOptimize(total);
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(query_count));
+    if (capacity)
+        state.counters["hit_rate"] = static_cast<double>(cache.hits()) / static_cast<double>(cache.hits() + cache.misses());
+}
+
+/// Major and minor page faults of the process so far
+static std::pair<long, long> page_faults() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return {usage.ru_majflt, usage.ru_minflt};
+}
+
+/// Inserts keys into tree stored in file, then runs range counts over it
+static void BM_Mapped(benchmark::State& state) {
+    const std::size_t count = static_cast<std::size_t>(state.range(0));
+    const std::string path = "bench_mapped_" + std::to_string(count) + ".rbt";
+    std::vector<int> keys = random_keys(count);
+    std::vector<int> lo = random_keys(query_count);
+
+    long major_faults = 0, minor_faults = 0;
+    double insert_time = 0, query_time = 0, pages = 0;
+    for (auto _ : state) {
+        std::remove(path.c_str());
+        RBTree::MappedTree<int, std::less<int>, std::uint64_t> tree;
+        if (!tree.open(path)) {
+            state.SkipWithError("Failed to open tree file");
+            break;
+        }
+
+        auto [major_start, minor_start] = page_faults();
+        auto start = std::chrono::steady_clock::now();
+        for (int key: keys) tree.insert(key);
+        auto inserted = std::chrono::steady_clock::now();
+
+        std::size_t total = 0;
+        for (int key: lo) total += tree.count_range(key, key / 2 + (1 << 30));
+        benchmark::DoNotOptimize(total);
+        auto finish = std::chrono::steady_clock::now();
+
+        auto [major_end, minor_end] = page_faults();
+        major_faults += major_end - major_start;
+        minor_faults += minor_end - minor_start;
+        insert_time += std::chrono::duration<double>(inserted - start).count();
+        query_time  += std::chrono::duration<double>(finish - inserted).count();
+
+        for (int key: lo) pages += static_cast<double>(tree.pages_on_path(key));
+    }
+    std::remove(path.c_str());
+
+    double iterations = static_cast<double>(state.iterations());
+    state.counters["major_faults"] = static_cast<double>(major_faults) / iterations;
+    state.counters["minor_faults"] = static_cast<double>(minor_faults) / iterations;
+    state.counters["inserts_per_second"] = static_cast<double>(count) * iterations / insert_time;
+    state.counters["queries_per_second"] = static_cast<double>(query_count) * iterations / query_time;
+    state.counters["pages_per_descent"] = pages / (static_cast<double>(query_count) * iterations);
+}
+
+/// Hardware cache miss counter of the calling thread, unavailable if perf events are not permitted
+class CacheMissCounter {
+    int fd_ = -1;
+
+public:
+    CacheMissCounter() {
+        perf_event_attr attr{};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+    ~CacheMissCounter() { if (fd_ >= 0) close(fd_); }
+
+    CacheMissCounter(const CacheMissCounter&) = delete;
+    CacheMissCounter &operator=(const CacheMissCounter&) = delete;
+
+    bool available() const { return fd_ >= 0; }
+
+    long long read_value() const {
+        long long value = 0;
+        if (fd_ < 0 || read(fd_, &value, sizeof(value)) != sizeof(value))
+            return 0;
+        return value;
+    }
+};
+
+/// std::less that counts full key comparisons
+struct CountingLess {
+    static inline std::size_t count = 0;
+
+    bool operator()(const std::string& lhs, const std::string& rhs) const {
+        count++;
+        return lhs < rhs;
+    }
+};
+
+/// Keys like "kqzvo.org/docs/48213": random host, few common paths, random id
+static std::vector<std::string> url_keys(std::size_t count) {
+    static const char *tlds[] = {"com", "org", "net", "io"};
+    static const char *paths[] = {"index", "docs", "blog/post", "api/v1/items", "static/img"};
+
+    std::mt19937 gen(7);
+    std::uniform_int_distribution<int> letter('a', 'z');
+    std::uniform_int_distribution<std::size_t> host_len(3, 10), tld(0, 3), path(0, 4);
+    std::uniform_int_distribution<int> id(0, 1 << 20);
+
+    std::vector<std::string> keys(count);
+    for (std::string& key: keys) {
+        std::size_t length = host_len(gen);
+        for (std::size_t index = 0; index < length; index++) key += static_cast<char>(letter(gen));
+        key += std::string(".") + tlds[tld(gen)] + "/" + paths[path(gen)] + "/" + std::to_string(id(gen));
+    }
+
+    return keys;
+}
+
+/// Lower bounds and range counts over URL-like string keys with or without inline prefixes
+template <typename PrefixT>
+static void BM_Url_Keys(benchmark::State& state) {
+    const std::size_t count = static_cast<std::size_t>(state.range(0));
+    std::vector<std::string> keys = url_keys(count);
+
+    RBTree::Tree<std::string, CountingLess, PrefixT> tree;
+    for (const std::string& key: keys) tree.insert(key);
+
+    std::vector<std::string> queries = url_keys(query_count);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(1));
+
+    CacheMissCounter cache_misses;
+    CountingLess::count = 0;
+    long long misses_start = cache_misses.read_value();
+
+    for (auto _ : state) {
+        std::size_t total = 0;
+        for (std::size_t index = 0; index < query_count; index++) {
+            // unordered bounds would return after one comparison
+            auto [lo, hi] = std::minmax(queries[index], keys[index % count]);
+            total += tree.count_range(lo, hi);
+            benchmark::DoNotOptimize(tree.lower_bound(keys[index % count]));
+        }
+        benchmark::DoNotOptimize(total);
+    }
+
+    double queries_done = static_cast<double>(state.iterations() * query_count);
+    state.counters["full_compares_per_query"] = static_cast<double>(CountingLess::count) / queries_done;
+    if (cache_misses.available())
+        state.counters["cache_misses_per_query"] = static_cast<double>(cache_misses.read_value() - misses_start) / queries_done;
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(query_count));
+}
+
 static std::vector<std::pair<std::string, std::string>> parse_bench_list(std::fstream& list) {
     std::vector<std::pair<std::string, std::string>> tests;
 
@@ -137,7 +610,55 @@ int main(int argc, char **argv) {
 
     auto tests = parse_bench_list(bench_list);
     for (auto test: tests) {
-        ::benchmark::RegisterBenchmark(test.first, bench_func, path_prefix + "/" + test.second);
+        ::benchmark::RegisterBenchmark(test.first.c_str(), bench_func, path_prefix + "/" + test.second);
+    }
+
+    if (bench_type != "STD_SET") {
+        ::benchmark::RegisterBenchmark("Rebuild by insert", BM_Rebuild_Insert)->RangeMultiplier(10)->Range(10000, 1000000);
+        ::benchmark::RegisterBenchmark("Snapshot reload", BM_Snapshot_Reload)->RangeMultiplier(10)->Range(10000, 1000000);
+        ::benchmark::RegisterBenchmark("Clone", BM_Clone)->ArgsProduct({{10000, 100000, 1000000}, {1, 4}})->UseRealTime();
+        // largest tree takes ~200 MB, well beyond L3
+        ::benchmark::RegisterBenchmark("Lower bound", BM_Lower_Bound)->ArgsProduct({{1 << 16, 1 << 20, 1 << 22}, {0, 1}});
+        ::benchmark::RegisterBenchmark("Count range", BM_Count_Range)->ArgsProduct({{1 << 16, 1 << 20, 1 << 22}, {0, 1}});
+
+        ::benchmark::RegisterBenchmark("URL keys full compare", BM_Url_Keys<RBTree::no_key_prefix>)->Arg(1 << 16)->Arg(1 << 20);
+        ::benchmark::RegisterBenchmark("URL keys prefix",       BM_Url_Keys<RBTree::string_key_prefix>)->Arg(1 << 16)->Arg(1 << 20);
+
+        // workloads: 0 random inserts, 1 sorted inserts, 2 uniform queries, 3 hot-key queries
+        const std::vector<std::vector<int64_t>> policy_args = {{RANDOM_INSERTS, SORTED_INSERTS, UNIFORM_QUERIES, HOT_KEY_QUERIES},
+                                                               {1 << 16, 1 << 20}};
+        ::benchmark::RegisterBenchmark("Policy red-black",       BM_Policy<RBTree::red_black>)->ArgsProduct(policy_args);
+        ::benchmark::RegisterBenchmark("Policy AVL",             BM_Policy<RBTree::avl>)->ArgsProduct(policy_args);
+        ::benchmark::RegisterBenchmark("Policy treap",           BM_Policy<RBTree::treap>)->ArgsProduct(policy_args);
+        ::benchmark::RegisterBenchmark("Policy splay",           BM_Policy<RBTree::splay>)->ArgsProduct(policy_args);
+        ::benchmark::RegisterBenchmark("Policy weight-balanced", BM_Policy<RBTree::weight_balanced>)->ArgsProduct(policy_args);
+
+        ::benchmark::RegisterBenchmark("Range 2D insert", BM_Range2D_Insert)->RangeMultiplier(10)->Range(10000, 100000);
+        ::benchmark::RegisterBenchmark("Range 2D count",  BM_Range2D_Count)->RangeMultiplier(10)->Range(10000, 100000);
+
+        // inserts per query x buffer capacity x query mode, plain tree runs once per ratio
+        ::benchmark::RegisterBenchmark("Buffered", BM_Buffered)
+            ->ArgNames({"inserts_per_query", "buffer", "flush"})
+            ->Apply([](benchmark::internal::Benchmark *bench) {
+                for (int64_t ratio: {1, 10, 100, 1000}) {
+                    bench->Args({ratio, 0, 0});
+                    for (int64_t capacity: {256, 4096, 65536})
+                        bench->Args({ratio, capacity, 0})->Args({ratio, capacity, 1});
+                }
+            });
+
+        // distinct queries x cache capacity
+        ::benchmark::RegisterBenchmark("RangeCache", BM_RangeCache)->ArgsProduct({{16, 256, 4096}, {0, 64, 1024, 8192}});
+
+        // set RBTREE_BENCH_COMPACT_KEYS to add a larger tree, 10^8 keys take ~5 GB
+        auto compact = ::benchmark::RegisterBenchmark("Compact", BM_Compact)->ArgsProduct({{1 << 20, 1 << 22}, {0, 1, 2}});
+        if (const char *compact_keys = std::getenv("RBTREE_BENCH_COMPACT_KEYS"))
+            compact->ArgsProduct({{std::stoll(compact_keys)}, {0, 1, 2}});
+
+        // set RBTREE_BENCH_MAPPED_KEYS to a key count whose tree exceeds available RAM
+        auto mapped = ::benchmark::RegisterBenchmark("Mapped", BM_Mapped)->Arg(1 << 16)->Arg(1 << 20)->Iterations(1)->Unit(benchmark::kMillisecond);
+        if (const char *mapped_keys = std::getenv("RBTREE_BENCH_MAPPED_KEYS"))
+            mapped->Arg(std::stoll(mapped_keys));
     }
 
     ::benchmark::Initialize(&argc, argv);
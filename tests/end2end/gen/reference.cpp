@@ -1,9 +1,11 @@
 #include <iostream>
 #include <iterator>
 #include <set>
+#include <utility>
 
 int main() {
     std::set<int> set;
+    std::set<std::pair<int, int>> points;
 
     std::string input = "";
     while (std::cin >> input) {
@@ -25,6 +27,22 @@ int main() {
             }
 
             std::cout << dist << " ";
+        } else if (input == "p") {
+            int x = 0, y = 0;
+            std::cin >> x >> y;
+
+            points.emplace(x, y);
+        } else if (input == "r") {
+            int x_lo = 0, x_hi = 0, y_lo = 0, y_hi = 0;
+            std::cin >> x_lo >> x_hi >> y_lo >> y_hi;
+
+            // brute force over all points
+            int count = 0;
+            for (auto [x, y]: points) {
+                count += (x_lo <= x && x <= x_hi && y_lo <= y && y <= y_hi);
+            }
+
+            std::cout << count << " ";
         }
     }
     std::cout << "\n";
@@ -1,5 +1,9 @@
 import os
 import random
+import sys
+
+# Usage: python3 test_gen.py [2d]
+# without arguments generates key tests, with "2d" - point tests
 
 tests_folder = ".."
 
@@ -8,28 +12,59 @@ test_per_len = 10
 test_lens = [100, 1000, 10000, 100000]
 unique_elem_coeff = 0.6
 
+test_lens_2d = [100, 1000, 10000]
+test_per_len_2d = 3
+
 test_names = []
 
-for test_len in test_lens:
-    for test_index in range(test_per_len):
-        test_name = f"auto_test_{test_len}_{test_index}"
-        test_path = os.path.join(tests_folder, test_name + ".dat")
-        test_names.append(test_name)
+def gen_key_test(test_file, test_len):
+    unique_elems = test_len * unique_elem_coeff
+
+    cur_test_len = 0
+    while cur_test_len < test_len:
+        cur_streak_len = random.randint(0, query_max_freq)
+        cur_test_len += cur_streak_len
+
+        for i in range(cur_streak_len):
+            test_file.write(f"k {random.randint(1, unique_elems)} ")
+
+        query_left  = random.randint(1, unique_elems)
+        query_right = random.randint(1, unique_elems)
+        test_file.write(f"q {query_left} {query_right} ")
 
-        unique_elems = test_len * unique_elem_coeff
+def gen_point_test(test_file, test_len):
+    # (timestamp, value) points: timestamps mostly grow, values are random
+    max_value = test_len
+    timestamp = 0
 
-        with open(test_path, "w") as test_file:
-            cur_test_len = 0
-            while cur_test_len < test_len:
-                cur_streak_len = random.randint(0, query_max_freq)
-                cur_test_len += cur_streak_len
+    cur_test_len = 0
+    while cur_test_len < test_len:
+        cur_streak_len = random.randint(0, query_max_freq)
+        cur_test_len += cur_streak_len
 
-                for i in range(cur_streak_len):
-                    test_file.write(f"k {random.randint(1, unique_elems)} ")
+        for i in range(cur_streak_len):
+            timestamp += random.randint(-2, 5)
+            test_file.write(f"p {timestamp} {random.randint(1, max_value)} ")
+
+        t_lo = random.randint(0, max(timestamp, 1))
+        t_hi = random.randint(t_lo - 10, max(timestamp, 1))
+        v_lo = random.randint(1, max_value)
+        v_hi = random.randint(v_lo - 10, max_value)
+        test_file.write(f"r {t_lo} {t_hi} {v_lo} {v_hi} ")
+
+if len(sys.argv) > 1 and sys.argv[1] == "2d":
+    tests = [(f"auto_test_2d_{test_len}_{test_index}", test_len, gen_point_test)
+             for test_len in test_lens_2d for test_index in range(test_per_len_2d)]
+else:
+    tests = [(f"auto_test_{test_len}_{test_index}", test_len, gen_key_test)
+             for test_len in test_lens for test_index in range(test_per_len)]
+
+for test_name, test_len, gen_test in tests:
+    test_path = os.path.join(tests_folder, test_name + ".dat")
+    test_names.append(test_name)
 
-                query_left  = random.randint(1, unique_elems)
-                query_right = random.randint(1, unique_elems)
-                test_file.write(f"q {query_left} {query_right} ")
+    with open(test_path, "w") as test_file:
+        gen_test(test_file, test_len)
 
 os.system("g++ reference.cpp -o reference")
 
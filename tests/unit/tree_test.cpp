@@ -1,6 +1,19 @@
 #include "gtest/gtest.h"
 
 #include "rbtree.hpp"
+#include "rbtree_buffered.hpp"
+#include "rbtree_cache.hpp"
+#include "rbtree_parallel.hpp"
+#include "rbtree_snapshot.hpp"
+#include "rbtree_mapped.hpp"
+#include "rbtree_range2d.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <set>
+#include <vector>
 
 namespace RBTree {
 
@@ -10,44 +23,679 @@ using TreeInt = Tree<int>;
 
 /***************  MOVE  ****************/
 TEST(Move, Ctor) {
-    using Node = TreeInt::Node;
     TreeInt tree;
 
-    auto old_root = tree.root_ = new Node(2, NIL);
-    auto old_left  = tree.root_->left_  = new Node(1, tree.root_, NIL, NIL);
-    auto old_right = tree.root_->right_ = new Node(3, tree.root_, NIL, NIL);
+    auto old_root = tree.root_ = tree.create_node(2, NIL);
+    auto old_left  = tree.root_->left_  = tree.create_node(1, tree.root_, NIL, NIL);
+    auto old_right = tree.root_->right_ = tree.create_node(3, tree.root_, NIL, NIL);
 
     TreeInt tree2(std::move(tree));
-    EXPECT_NE(tree.tree_nil_, tree2.tree_nil_);
-    EXPECT_NE(tree.root_, tree2.root_);
-    EXPECT_EQ(tree.root_->parent_, tree.tree_nil_);
+    EXPECT_EQ(tree.root_, tree.tree_nil_);
+    EXPECT_EQ(tree2.root_, old_root);
+    EXPECT_EQ(tree2.root_->left_, old_left);
+    EXPECT_EQ(tree2.root_->right_, old_right);
     EXPECT_EQ(tree2.root_->parent_, tree2.tree_nil_);
+
+    static_assert(std::is_nothrow_move_constructible_v<TreeInt>);
 }
 
 TEST(Move, Assign) {
-    using Node = TreeInt::Node;
     TreeInt tree;
 
-    auto old_root = tree.root_ = new Node(2, NIL);
-    auto old_left  = tree.root_->left_  = new Node(1, tree.root_, NIL, NIL);
-    auto old_right = tree.root_->right_ = new Node(3, tree.root_, NIL, NIL);
+    auto old_root = tree.root_ = tree.create_node(2, NIL);
+    auto old_left  = tree.root_->left_  = tree.create_node(1, tree.root_, NIL, NIL);
+    auto old_right = tree.root_->right_ = tree.create_node(3, tree.root_, NIL, NIL);
 
     TreeInt tree2;
     tree2 = std::move(tree);
-    EXPECT_NE(tree.tree_nil_, tree2.tree_nil_);
-    EXPECT_NE(tree.root_, tree2.root_);
-    EXPECT_EQ(tree.root_->parent_, tree.tree_nil_);
+    EXPECT_EQ(tree.root_, tree.tree_nil_);
+    EXPECT_EQ(tree2.root_, old_root);
+    EXPECT_EQ(tree2.root_->left_, old_left);
+    EXPECT_EQ(tree2.root_->right_, old_right);
     EXPECT_EQ(tree2.root_->parent_, tree2.tree_nil_);
+
+    static_assert(std::is_nothrow_move_assignable_v<TreeInt>);
+}
+
+/*************** CLONE *****************/
+TEST(Clone, CopyCtor) {
+    TreeInt tree;
+    for (int key = 0; key < 1000; key++) tree.insert((key * 7919) % 1009);
+
+    TreeInt copy(tree);
+    EXPECT_TRUE(copy.validate());
+    EXPECT_EQ(copy.size(), tree.size());
+    EXPECT_EQ(*copy.get_root(), *tree.get_root());
+
+    auto it = tree.lower_bound(0), copy_it = copy.lower_bound(0);
+    for (; !it.is_end(); ++it, ++copy_it) {
+        EXPECT_EQ(*it, *copy_it);
+    }
+    EXPECT_TRUE(copy_it.is_end());
+
+    // copy is independent and mutable
+    copy.insert(2000);
+    EXPECT_TRUE(copy.validate());
+    EXPECT_EQ(copy.size(), tree.size() + 1);
+    EXPECT_TRUE(tree.upper_bound(1999).is_end());
+
+    TreeInt assigned;
+    assigned.insert(-1);
+    assigned = copy;
+    EXPECT_TRUE(assigned.validate());
+    EXPECT_EQ(assigned.size(), copy.size());
+    EXPECT_TRUE(assigned.lower_bound(-1) == assigned.lower_bound(0));
+}
+
+TEST(Clone, Parallel) {
+    Tree<std::string> tree;
+    for (int key = 0; key < 50000; key++) tree.insert(std::to_string(key));
+
+    Tree<std::string> copy = tree.clone(4);
+    EXPECT_TRUE(copy.validate());
+    EXPECT_EQ(copy.size(), tree.size());
+    EXPECT_EQ(copy.distance(copy.lower_bound("1"), copy.upper_bound("2")),
+              tree.distance(tree.lower_bound("1"), tree.upper_bound("2")));
+
+    Tree<std::string> empty;
+    EXPECT_EQ(empty.clone(4).size(), 0);
+}
+
+/*************** BATCH *****************/
+TEST(Batch, LowerBound) {
+    TreeInt tree;
+    for (int key = 0; key < 5000; key++) tree.insert((key * 7919) % 10007);
+
+    std::vector<int> keys;
+    for (int key = -10; key < 10020; key += 3) keys.push_back(key);
+
+    std::vector<TreeInt::iterator> result(keys.size());
+    tree.lower_bound_batch(keys, result);
+
+    for (std::size_t index = 0; index < keys.size(); index++) {
+        EXPECT_TRUE(result[index] == tree.lower_bound(keys[index]));
+    }
+
+    TreeInt empty;
+    empty.lower_bound_batch(keys, result);
+    EXPECT_TRUE(result.back().is_end());
+}
+
+TEST(Batch, CountRange) {
+    TreeInt tree;
+    for (int key = 0; key < 5000; key++) tree.insert((key * 7919) % 10007);
+
+    std::vector<int> lo, hi;
+    for (int key = -10; key < 10020; key += 7) {
+        lo.push_back(key);
+        hi.push_back(key + (key * 31) % 997 - 100);
+    }
+
+    std::vector<std::size_t> result(lo.size());
+    tree.count_range_batch(lo, hi, result);
+
+    for (std::size_t index = 0; index < lo.size(); index++) {
+        std::size_t expected = 0;
+        if (hi[index] >= lo[index])
+            expected = tree.distance(tree.lower_bound(lo[index]), tree.upper_bound(hi[index]));
+
+        EXPECT_EQ(tree.count_range(lo[index], hi[index]), expected);
+        EXPECT_EQ(result[index], expected);
+    }
+}
+
+/*************** BALANCE ****************/
+template <typename BalanceT>
+class Balance : public ::testing::Test {};
+
+using BalancePolicies = ::testing::Types<red_black, avl, treap, splay, weight_balanced>;
+TYPED_TEST_SUITE(Balance, BalancePolicies);
+
+TYPED_TEST(Balance, MatchesStdSet) {
+    Tree<int, std::less<int>, no_key_prefix, TypeParam> tree;
+    std::set<int> reference;
+
+    for (int key = 0; key < 5000; key++) {
+        int value = (key * 7919) % 10007;
+        EXPECT_EQ(tree.insert(value), reference.insert(value).second);
+
+        if (key % 500 == 0)
+            ASSERT_TRUE(tree.validate());
+
+        // lookups splay, so interleave them with inserts
+        if (key % 7 == 0) {
+            int lo = value - 500, hi = value + 500;
+            std::size_t expected = static_cast<std::size_t>(
+                std::distance(reference.lower_bound(lo), reference.upper_bound(hi)));
+            EXPECT_EQ(tree.distance(tree.lower_bound(lo), tree.upper_bound(hi)), expected);
+            EXPECT_EQ(tree.count_range(lo, hi), expected);
+        }
+    }
+    EXPECT_TRUE(tree.validate());
+    EXPECT_EQ(tree.size(), reference.size());
+
+    auto it = tree.lower_bound(-1);
+    for (int key: reference) {
+        ASSERT_FALSE(it.is_end());
+        EXPECT_EQ(*it, key);
+        ++it;
+    }
+    EXPECT_TRUE(it.is_end());
+}
+
+TYPED_TEST(Balance, SortedInsertsAndCopies) {
+    Tree<int, std::less<int>, no_key_prefix, TypeParam> tree;
+    for (int key = 0; key < 4096; key++) tree.insert(key);
+    ASSERT_TRUE(tree.validate());
+
+    // splay trees may degenerate, all others stay logarithmic
+    if constexpr (!std::is_same_v<TypeParam, splay>)
+        EXPECT_LE(tree.height(), 40);
+
+    auto copy = tree.clone();
+    EXPECT_TRUE(copy.validate());
+    EXPECT_EQ(copy.height(), tree.height());
+
+    const std::string path = "snapshot_balance.bin";
+    ASSERT_TRUE(tree.save(path));
+
+    decltype(tree) loaded;
+    ASSERT_TRUE(loaded.load(path));
+    std::remove(path.c_str());
+
+    EXPECT_TRUE(loaded.validate());
+    EXPECT_EQ(loaded.count_range(100, 1099), 1000);
+
+    // tree stays valid for inserts after rebuild
+    for (int key = 5000; key > 4000; key--) loaded.insert(key);
+    EXPECT_TRUE(loaded.validate());
+    EXPECT_EQ(loaded.size(), 5001);
+}
+
+TYPED_TEST(Balance, InsertSorted) {
+    Tree<int, std::less<int>, no_key_prefix, TypeParam> tree;
+    std::set<int> reference;
+    for (int key = 0; key < 3000; key++) {
+        tree.insert((key * 7919) % 10007);
+        reference.insert((key * 7919) % 10007);
+    }
+
+    // batches of close and far keys, some of them already in the tree
+    for (int batch = 0; batch < 20; batch++) {
+        std::vector<int> keys;
+        for (int key = 0; key < 200; key++) keys.push_back((key * 7 + batch * 31) % (batch % 2 ? 500 : 20000) + batch);
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+        tree.insert_sorted(keys);
+        reference.insert(keys.begin(), keys.end());
+        ASSERT_TRUE(tree.validate());
+    }
+
+    EXPECT_EQ(tree.size(), reference.size());
+    EXPECT_TRUE(std::equal(reference.begin(), reference.end(), tree.begin()));
+}
+
+// sorted inserts make a splay tree a path, traversals must not recurse per level
+TEST(Balance, DeepSplayTree) {
+    using SplayTree = Tree<int, std::less<int>, no_key_prefix, splay>;
+    constexpr int count = 2000000;
+
+    SplayTree tree;
+    for (int key = 0; key < count; key++) tree.insert(key);
+    ASSERT_EQ(tree.height(), count);
+    EXPECT_TRUE(tree.validate());
+
+    SplayTree copy = tree.clone();
+    EXPECT_TRUE(copy.validate());
+    EXPECT_EQ(copy.height(), count);
+
+    SplayTree parallel_copy = tree.clone(4);
+    EXPECT_TRUE(parallel_copy.validate());
+
+    SplayTree assigned;
+    assigned = copy;
+    EXPECT_TRUE(assigned.validate());
+    EXPECT_EQ(assigned.size(), static_cast<std::size_t>(count));
+}
+
+TEST(Balance, ConstLookupsDontSplay) {
+    Tree<int, std::less<int>, no_key_prefix, splay> tree;
+    for (int key = 0; key < 1000; key++) tree.insert(key);
+
+    const auto &const_tree = tree;
+    EXPECT_EQ(*const_tree.lower_bound(10), 10);
+    EXPECT_EQ(*const_tree.upper_bound(10), 11);
+    EXPECT_EQ(*tree.get_root(), 999);
+
+    EXPECT_EQ(*tree.lower_bound(10), 10);
+    EXPECT_EQ(*tree.get_root(), 10);
+    EXPECT_TRUE(tree.validate());
+}
+
+TEST(Balance, ShapeOfOtherPolicy) {
+    TreeInt tree;
+    for (int key = 0; key < 1000; key++) tree.insert(key);
+
+    const std::string path = "snapshot_other_policy.bin";
+    ASSERT_TRUE(tree.save(path));
+
+    // red-black shape of sorted inserts is not an AVL tree: load rebuilds it balanced
+    Tree<int, std::less<int>, no_key_prefix, avl> loaded;
+    ASSERT_TRUE(loaded.load(path));
+    std::remove(path.c_str());
+
+    EXPECT_TRUE(loaded.validate());
+    EXPECT_EQ(loaded.height(), 10);
+    EXPECT_EQ(loaded.size(), 1000);
+}
+
+/*************** RANGE 2D ****************/
+TEST(Range2D, MatchesBruteForce) {
+    RangeTree2D<int, int> points;
+    std::set<std::pair<int, int>> reference;
+
+    for (int index = 0; index < 3000; index++) {
+        // increasing x with few repeats stresses rebuilds of the right spine
+        int x = index / 3, y = (index * 7919) % 211;
+        EXPECT_EQ(points.insert(x, y), reference.emplace(x, y).second);
+        EXPECT_FALSE(points.insert(x, y));
+
+        if (index % 37 == 0) {
+            int x_lo = (index * 13) % 1000, x_hi = x_lo + index % 300;
+            int y_lo = (index * 17) % 211 - 20, y_hi = y_lo + index % 120;
+
+            std::size_t expected = 0;
+            for (auto [px, py]: reference) {
+                expected += (x_lo <= px && px <= x_hi && y_lo <= py && py <= y_hi);
+            }
+            EXPECT_EQ(points.count(x_lo, x_hi, y_lo, y_hi), expected);
+        }
+    }
+    EXPECT_EQ(points.size(), reference.size());
+
+    EXPECT_EQ(points.count(0, 1000, 0, 210), reference.size());
+    EXPECT_EQ(points.count(10, 5, 0, 210), 0);
+    RangeTree2D<int, int> empty;
+    EXPECT_EQ(empty.count(0, 10, 0, 10), 0);
+}
+
+/*************** BUFFERED ****************/
+TEST(Buffered, MatchesStdSet) {
+    using Buffered = BufferedTree<int>;
+
+    for (auto mode: {Buffered::QueryMode::merge, Buffered::QueryMode::flush}) {
+        // small capacity flushes by inserts, large one by merging tree keys
+        for (std::size_t capacity: {1, 16, 4096}) {
+            TreeInt tree;
+            Buffered buffered(tree, capacity, mode);
+            std::set<int> reference;
+
+            for (int index = 0; index < 20000; index++) {
+                int key = (index * 7919) % 6007;
+                buffered.insert(key);
+                reference.insert(key);
+
+                if (index % 13 == 0) {
+                    int lo = key - 300, hi = key + 200;
+                    std::size_t expected = static_cast<std::size_t>(
+                        std::distance(reference.lower_bound(lo), reference.upper_bound(hi)));
+                    ASSERT_EQ(buffered.count_range(lo, hi), expected);
+                }
+            }
+            EXPECT_EQ(buffered.size(), reference.size());
+
+            buffered.flush();
+            EXPECT_EQ(buffered.buffered(), 0);
+            EXPECT_TRUE(tree.validate());
+            EXPECT_EQ(tree.size(), reference.size());
+            EXPECT_TRUE(std::equal(reference.begin(), reference.end(), tree.begin()));
+        }
+    }
+}
+
+/*************** RANGE CACHE ****************/
+TEST(RangeCache, MatchesStdSet) {
+    // zero capacity caches nothing, small one evicts all the time
+    for (std::size_t capacity: {0, 1, 8, 1024}) {
+        TreeInt tree;
+        RangeCountCache<int> cache(tree, capacity);
+        std::set<int> reference;
+
+        for (int index = 0; index < 20000; index++) {
+            int key = (index * 7919) % 6007;
+            EXPECT_EQ(cache.insert(key), reference.insert(key).second);
+
+            // a few dashboard ranges repeated, some of them nested or overlapping
+            int lo = (index % 37) * 150, hi = lo + (index % 5) * 400;
+            std::size_t expected = static_cast<std::size_t>(
+                std::distance(reference.lower_bound(lo), reference.upper_bound(hi)));
+            ASSERT_EQ(cache.count_range(lo, hi), expected);
+        }
+        EXPECT_EQ(cache.count_range(10, 5), 0);
+        EXPECT_LE(cache.size(), capacity);
+        EXPECT_EQ(cache.hits() + cache.misses(), 20000);
+        if (capacity == 1024)
+            EXPECT_EQ(cache.misses(), 37 * 5);
+
+        EXPECT_TRUE(tree.validate());
+        EXPECT_EQ(tree.size(), reference.size());
+    }
+}
+
+/*************** COMPACT ****************/
+TEST(Compact, Layouts) {
+    for (auto layout: {TreeInt::Layout::depth_first, TreeInt::Layout::van_emde_boas}) {
+        TreeInt tree;
+        for (int key = 0; key < 3000; key++) tree.insert((key * 7919) % 10007);
+        const std::size_t height = tree.height();
+
+        tree.compact(layout);
+        ASSERT_TRUE(tree.validate());
+        EXPECT_EQ(tree.height(), height);
+
+        // root goes first and all nodes are in one block
+        std::vector<const void *> nodes;
+        for (auto it = tree.begin(); !it.is_end(); ++it) nodes.push_back(it.ptr_);
+        ASSERT_EQ(nodes.size(), 3000);
+        for (const void *node: nodes) {
+            EXPECT_GE(node, static_cast<const void *>(tree.root_));
+            EXPECT_LT(node, static_cast<const void *>(tree.root_ + 3000));
+        }
+
+        int prev = -1;
+        for (auto it = tree.begin(); !it.is_end(); ++it) {
+            EXPECT_LT(prev, *it);
+            prev = *it;
+        }
+
+        // tree stays mutable
+        for (int key = 10007; key < 11000; key++) tree.insert(key);
+        EXPECT_TRUE(tree.validate());
+        EXPECT_EQ(tree.size(), 3993);
+        EXPECT_EQ(tree.count_range(10007, 20000), 993);
+    }
+}
+
+TEST(Compact, Automatic) {
+    Tree<std::string> tree;
+    tree.set_auto_compact(100);
+
+    for (int key = 0; key < 1000; key++) {
+        tree.insert(std::to_string(key));
+        tree.insert(std::to_string(key));
+    }
+    EXPECT_TRUE(tree.validate());
+    EXPECT_EQ(tree.size(), 1000);
+    EXPECT_EQ(*tree.lower_bound("999"), "999");
+    EXPECT_EQ(tree.count_range("100", "199"), 109);
+}
+
+/*************** MAPPED ****************/
+template <typename OffsetT>
+static void check_mapped_tree() {
+    const std::string path = "mapped_tree_" + std::to_string(sizeof(OffsetT)) + ".rbt";
+    std::remove(path.c_str());
+
+    TreeInt tree;
+    {
+        MappedTree<int, std::less<int>, OffsetT> mapped;
+        ASSERT_TRUE(mapped.open(path));
+
+        for (int key = 0; key < 20000; key++) {
+            int value = (key * 7919) % 30011;
+            EXPECT_EQ(mapped.insert(value), tree.insert(value));
+        }
+        EXPECT_TRUE(mapped.validate());
+        EXPECT_EQ(mapped.size(), tree.size());
+    }
+
+    // reopen without rebuild
+    MappedTree<int, std::less<int>, OffsetT> mapped;
+    ASSERT_TRUE(mapped.open(path));
+    EXPECT_TRUE(mapped.validate());
+    EXPECT_EQ(mapped.size(), tree.size());
+
+    for (int lo = -10; lo < 30100; lo += 97) {
+        int hi = lo + (lo * 13) % 5000;
+        EXPECT_EQ(mapped.distance(mapped.lower_bound(lo), mapped.upper_bound(hi)),
+                  tree.distance(tree.lower_bound(lo), tree.upper_bound(hi)));
+        EXPECT_EQ(mapped.count_range(lo, hi), tree.count_range(lo, hi));
+    }
+
+    auto it = tree.lower_bound(0);
+    auto mapped_it = mapped.lower_bound(0);
+    for (; !it.is_end(); ++it, ++mapped_it) {
+        EXPECT_EQ(*it, *mapped_it);
+    }
+    EXPECT_TRUE(mapped_it.is_end());
+
+    EXPECT_TRUE(mapped.insert(-5));
+    EXPECT_FALSE(mapped.insert(-5));
+    EXPECT_TRUE(mapped.validate());
+
+    mapped.close();
+    std::remove(path.c_str());
+}
+
+TEST(Mapped, Offsets32) {
+    check_mapped_tree<std::uint32_t>();
+}
+
+TEST(Mapped, Offsets64) {
+    check_mapped_tree<std::uint64_t>();
+}
+
+/// Mapped tree is a Tree: other policies and batched queries work over the file too
+template <typename BalanceT>
+static void check_mapped_policy() {
+    const std::string path = "mapped_tree_policy.rbt";
+    std::remove(path.c_str());
+
+    using MappedT = MappedTree<int, std::less<int>, std::uint32_t, no_key_prefix, BalanceT>;
+
+    Tree<int, std::less<int>, no_key_prefix, BalanceT> tree;
+    {
+        MappedT mapped;
+        ASSERT_TRUE(mapped.open(path));
+        for (int key = 0; key < 5000; key++) {
+            int value = (key * 7919) % 10007;
+            EXPECT_EQ(mapped.insert(value), tree.insert(value));
+        }
+    }
+
+    MappedT mapped;
+    ASSERT_TRUE(mapped.open(path));
+    EXPECT_TRUE(mapped.validate());
+    EXPECT_EQ(mapped.size(), tree.size());
+
+    std::vector<int> lo, hi;
+    for (int key = -10; key < 10100; key += 37) {
+        lo.push_back(key);
+        hi.push_back(key + (key * 13) % 3000);
+    }
+    std::vector<std::size_t> result(lo.size());
+    mapped.count_range_batch(lo, hi, result);
+    for (std::size_t index = 0; index < lo.size(); index++) {
+        EXPECT_EQ(result[index], tree.count_range(lo[index], hi[index]));
+    }
+
+    mapped.close();
+    std::remove(path.c_str());
+}
+
+TEST(Mapped, Policies) {
+    check_mapped_policy<avl>();
+    check_mapped_policy<treap>();
+    check_mapped_policy<splay>();
+    check_mapped_policy<weight_balanced>();
+}
+
+/// Pages are relaid out by subtrees as the tree grows, a descent crosses few of them
+TEST(Mapped, PagesPerDescent) {
+    const std::string path = "mapped_tree_pages.rbt";
+    std::remove(path.c_str());
+
+    using MappedT = MappedTree<int, std::less<int>, std::uint64_t>;
+
+    std::mt19937 rng(3);
+    MappedT mapped;
+    ASSERT_TRUE(mapped.open(path));
+    for (int key = 0; key < 200000; key++) mapped.insert(static_cast<int>(rng()));
+    EXPECT_TRUE(mapped.validate());
+
+    // 18 levels with more than 64 nodes in a page
+    std::size_t pages = 0;
+    const std::size_t queries = 1000;
+    for (std::size_t query = 0; query < queries; query++) pages += mapped.pages_on_path(static_cast<int>(rng()));
+    EXPECT_LE(pages, 6 * queries);
+
+    mapped.compact();
+    pages = 0;
+    for (std::size_t query = 0; query < queries; query++) pages += mapped.pages_on_path(static_cast<int>(rng()));
+    EXPECT_LE(pages, 4 * queries);
+
+    std::size_t size = mapped.size();
+    mapped.close();
+    ASSERT_TRUE(mapped.open(path));
+    EXPECT_EQ(mapped.size(), size);
+    EXPECT_TRUE(mapped.validate());
+
+    mapped.close();
+    std::remove(path.c_str());
+}
+
+TEST(Mapped, WrongFormat) {
+    const std::string path = "mapped_tree_format.rbt";
+    std::remove(path.c_str());
+    {
+        MappedTree<int> mapped;
+        ASSERT_TRUE(mapped.open(path));
+        mapped.insert(1);
+    }
+
+    MappedTree<long long> other_key;
+    EXPECT_FALSE(other_key.open(path));
+    MappedTree<int, std::less<int>, std::uint64_t> other_offset;
+    EXPECT_FALSE(other_offset.open(path));
+    MappedTree<int, std::less<int>, std::uint32_t, no_key_prefix, avl> other_balance;
+    EXPECT_FALSE(other_balance.open(path));
+
+    MappedTree<int> mapped;
+    ASSERT_TRUE(mapped.open(path));
+    EXPECT_EQ(mapped.size(), 1u);
+
+    // copy of a file that is still open is what a crash leaves
+    const std::string crashed = "mapped_tree_crashed.rbt";
+    mapped.insert(2);
+    mapped.flush();
+    std::filesystem::copy_file(path, crashed, std::filesystem::copy_options::overwrite_existing);
+    MappedTree<int> reopened;
+    EXPECT_FALSE(reopened.open(crashed));
+
+    mapped.close();
+    std::remove(crashed.c_str());
+    std::remove(path.c_str());
+}
+
+/*************** PREFIX ****************/
+TEST(Prefix, StringEncoding) {
+    std::vector<std::string> keys = {"", "a", std::string("a\0", 2), "ab", "abcdefgh", "abcdefghi",
+                                     "abcdefgz", "b", "\xff", "\x7f\x80", "zzzzzzzzzzzz"};
+    std::sort(keys.begin(), keys.end());
+
+    for (std::size_t index = 0; index + 1 < keys.size(); index++) {
+        EXPECT_LE(string_key_prefix::encode(keys[index]), string_key_prefix::encode(keys[index + 1]));
+    }
+    EXPECT_EQ(string_key_prefix::encode("abcdefgh"), string_key_prefix::encode("abcdefghi"));
+}
+
+TEST(Prefix, SameAsFullCompare) {
+    Tree<std::string> tree;
+    Tree<std::string, std::less<std::string>, string_key_prefix> prefix_tree;
+
+    std::vector<std::string> keys;
+    for (int key = 0; key < 3000; key++) {
+        std::string value = "host" + std::to_string((key * 7919) % 211) + ".com/" + std::to_string(key % 17);
+        keys.push_back(value);
+        EXPECT_EQ(prefix_tree.insert(value), tree.insert(value));
+    }
+    EXPECT_TRUE(prefix_tree.validate());
+    EXPECT_EQ(prefix_tree.size(), tree.size());
+
+    std::sort(keys.begin(), keys.end());
+    std::vector<std::size_t> result(keys.size() - 1);
+    prefix_tree.count_range_batch(std::span(keys).first(result.size()), std::span(keys).last(result.size()), result);
+
+    for (std::size_t index = 0; index + 1 < keys.size(); index++) {
+        const std::string &lo = keys[index], &hi = keys[(index * 31) % keys.size()];
+        EXPECT_EQ(prefix_tree.count_range(lo, hi), tree.count_range(lo, hi));
+        auto prefix_it = prefix_tree.lower_bound(lo + "!");
+        auto it = tree.lower_bound(lo + "!");
+        ASSERT_EQ(prefix_it.is_end(), it.is_end());
+        if (!it.is_end())
+            EXPECT_EQ(*prefix_it, *it);
+        EXPECT_EQ(result[index], tree.count_range(keys[index], keys[index + 1]));
+    }
+}
+
+/*************** INSERT ****************/
+struct CountedKey {
+    static inline int copies = 0;
+
+    int value;
+
+    explicit CountedKey(int val) : value(val) {}
+    CountedKey(const CountedKey& rhs) : value(rhs.value) { copies++; }
+    CountedKey(CountedKey&& rhs) noexcept : value(rhs.value) {}
+    CountedKey &operator=(const CountedKey& rhs) = default;
+    CountedKey &operator=(CountedKey&& rhs) noexcept = default;
+
+    bool operator<(const CountedKey& rhs) const { return value < rhs.value; }
+};
+
+TEST(Insert, MoveAndEmplace) {
+    // CountedKey has no default constructor, so sentinel must not construct it
+    Tree<CountedKey> tree;
+    CountedKey::copies = 0;
+
+    EXPECT_TRUE(tree.insert(CountedKey(2)));
+    EXPECT_TRUE(tree.emplace(1));
+    EXPECT_TRUE(tree.emplace(CountedKey(3)));
+    EXPECT_FALSE(tree.emplace(3));
+    EXPECT_FALSE(tree.insert(CountedKey(2)));
+    EXPECT_EQ(CountedKey::copies, 0);
+
+    CountedKey key(4);
+    EXPECT_TRUE(tree.insert(key));
+    EXPECT_EQ(CountedKey::copies, 1);
+
+    EXPECT_EQ(tree.size(), 4);
+    EXPECT_TRUE(tree.validate());
+}
+
+TEST(Insert, TreesInVector) {
+    std::vector<Tree<std::string>> trees;
+    for (int index = 0; index < 100; index++) {
+        trees.emplace_back();
+        trees.back().insert(std::to_string(index));
+        trees.back().emplace(3, 'a');
+    }
+
+    for (int index = 0; index < 100; index++) {
+        EXPECT_EQ(trees[index].size(), 2);
+        EXPECT_EQ(*trees[index].lower_bound(std::to_string(index)), std::to_string(index));
+        EXPECT_TRUE(trees[index].validate());
+    }
 }
 
 /*************** ROTATE ****************/
 TEST(RotateTest, LeftRotate) {
-    using Node = TreeInt::Node;
     TreeInt tree;
 
-    auto old_root = tree.root_ = new Node(2, NIL);
-    auto old_left  = tree.root_->left_  = new Node(1, tree.root_, NIL, NIL);
-    auto old_right = tree.root_->right_ = new Node(3, tree.root_, NIL, NIL);
+    auto old_root = tree.root_ = tree.create_node(2, NIL);
+    auto old_left  = tree.root_->left_  = tree.create_node(1, tree.root_, NIL, NIL);
+    auto old_right = tree.root_->right_ = tree.create_node(3, tree.root_, NIL, NIL);
 
     tree.left_rotate(tree.root_);
     /*
@@ -72,12 +720,11 @@ TEST(RotateTest, LeftRotate) {
 }
 
 TEST(RotateTest, RightRotate) {
-    using Node = TreeInt::Node;
     TreeInt tree;
 
-    auto old_root = tree.root_ = new Node(2, NIL);
-    auto old_left  = tree.root_->left_  = new Node(1, tree.root_, NIL, NIL);
-    auto old_right = tree.root_->right_ = new Node(3, tree.root_, NIL, NIL);
+    auto old_root = tree.root_ = tree.create_node(2, NIL);
+    auto old_left  = tree.root_->left_  = tree.create_node(1, tree.root_, NIL, NIL);
+    auto old_right = tree.root_->right_ = tree.create_node(3, tree.root_, NIL, NIL);
 
     tree.right_rotate(tree.root_);
     /*
@@ -123,6 +770,89 @@ TEST(TreeItTest, Op_successor) {
     EXPECT_TRUE(it2.is_end());
 }
 
+/************** SNAPSHOT ***************/
+TEST(Snapshot, SaveLoad) {
+    TreeInt tree;
+    for (int key = 0; key < 1000; key++) {
+        tree.insert((key * 7919) % 1009);
+    }
+    ASSERT_TRUE(tree.validate());
+
+    const std::string path = "snapshot_save_load.bin";
+    ASSERT_TRUE(tree.save(path));
+
+    TreeInt loaded;
+    loaded.insert(-1);
+    ASSERT_TRUE(loaded.load(path));
+    std::remove(path.c_str());
+
+    EXPECT_TRUE(loaded.validate());
+    EXPECT_EQ(loaded.size(), tree.size());
+
+    auto it = tree.lower_bound(0), loaded_it = loaded.lower_bound(-1);
+    for (; !it.is_end() && !loaded_it.is_end(); ++it, ++loaded_it) {
+        EXPECT_EQ(*it, *loaded_it);
+    }
+    EXPECT_TRUE(it.is_end());
+    EXPECT_TRUE(loaded_it.is_end());
+
+    EXPECT_EQ(loaded.distance(loaded.lower_bound(100), loaded.upper_bound(200)),
+              tree.distance(tree.lower_bound(100), tree.upper_bound(200)));
+}
+
+TEST(Snapshot, BalancedRebuild) {
+    const std::string path = "snapshot_balanced.bin";
+
+    for (std::size_t count: {0, 1, 2, 3, 6, 7, 8, 100, 1023, 1024}) {
+        std::vector<int> keys(count);
+        for (std::size_t i = 0; i < count; i++) keys[i] = static_cast<int>(i * 2);
+
+        // write snapshot without shape section by hand
+        SnapshotHeader header{};
+        std::memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+        header.version     = snapshot_version;
+        header.key_size    = sizeof(int);
+        header.count       = count;
+        header.keys_offset = sizeof(SnapshotHeader);
+        header.checksum    = snapshot_checksum(reinterpret_cast<const unsigned char *>(keys.data()),
+                                               count * sizeof(int));
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(keys.data()), static_cast<std::streamsize>(count * sizeof(int)));
+        file.close();
+
+        TreeInt tree;
+        ASSERT_TRUE(tree.load(path));
+        EXPECT_TRUE(tree.validate());
+        EXPECT_EQ(tree.size(), count);
+        EXPECT_EQ(tree.distance(tree.lower_bound(0), tree.upper_bound(static_cast<int>(count))),
+                  (count == 0) ? 0 : count / 2 + 1);
+    }
+    std::remove(path.c_str());
+}
+
+TEST(Snapshot, Corrupted) {
+    TreeInt tree;
+    for (int key = 0; key < 100; key++) tree.insert(key);
+
+    const std::string path = "snapshot_corrupted.bin";
+    ASSERT_TRUE(tree.save(path));
+
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(sizeof(SnapshotHeader) + 4);
+    file.put('x');
+    file.close();
+
+    TreeInt loaded;
+    loaded.insert(42);
+    EXPECT_FALSE(loaded.load(path));
+    EXPECT_FALSE(loaded.load("no_such_snapshot.bin"));
+    EXPECT_EQ(loaded.size(), 1);
+
+    std::remove(path.c_str());
+}
+
 }
 
 int main(int argc, char **argv) {